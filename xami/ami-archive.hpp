@@ -29,6 +29,9 @@
 
 #include <iostream>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <exception>
 #include <tchar.h>
 #include "sysmemmap.h"
 #include "bindata.h"
@@ -36,6 +39,8 @@
 
 namespace xami {
 
+class archive_index;
+
 struct entry
 {
     uint32_t    id;
@@ -44,12 +49,76 @@ struct entry
     size_t      unpacked_size;
 };
 
+enum entry_type
+{
+    entry_raw,
+    entry_script,
+    entry_image,
+};
+
+typedef sys::mapping::const_view<char> data_window;
+
+// region of the mapped archive.  keeps mapping window it belongs to alive, so it stays
+// valid after reader moves on to another window.
+class archive_span
+{
+    std::shared_ptr<const data_window>  m_window;
+    const char*                         m_data;
+    size_t                              m_size;
+
+public:
+    archive_span () : m_data (0), m_size (0) { }
+    archive_span (std::shared_ptr<const data_window> window, const char* data, size_t size)
+        : m_window (std::move (window)), m_data (data), m_size (size) { }
+
+    const char* data () const { return m_data; }
+    size_t size () const { return m_size; }
+    const char* begin () const { return m_data; }
+    const char* end () const { return m_data + m_size; }
+    const char& operator[] (size_t i) const { return m_data[i]; }
+};
+
+// single archive entry passed between extraction worker threads and the writer.
+struct extract_job
+{
+    unsigned            seq;
+    unsigned            pos;        // position in extraction order
+    size_t              cost;       // memory reserved for this entry
+    uint32_t            id;
+    entry_type          type;
+    const char*         data;       // either view or unpacked contents
+    size_t              size;
+    bool                is_packed;  // entry left compressed and passed to the writer as is
+    archive_span        view;
+    std::vector<char>   unpacked;
+    std::vector<char>   converted;
+    bool                is_converted;
+    bool                is_skipped;
+    std::exception_ptr  error;
+
+    extract_job () : seq (0), pos (0), cost (0), id (0), type (entry_raw), data (0), size (0)
+                   , is_packed (false), is_converted (false), is_skipped (false) { }
+};
+
 class file_reader
 {
 protected:
     sys::mapping::readonly              m_in;
     sys::mapping::const_view<uint32_t>  m_header;
     unsigned                            m_count;
+    // (id, sequence number) pairs sorted by id
+    std::vector<std::pair<uint32_t, unsigned>>
+                                        m_index;
+    size_t                              m_extent;   // end of the last entry data
+
+    // archive data is mapped at once, unless it doesn't fit into address space, then it's
+    // mapped in windows of window_size bytes.
+    bool                                m_whole_mapped;
+    mutable std::shared_ptr<const data_window>
+                                        m_window;
+    mutable size_t                      m_window_offset;
+    mutable std::mutex                  m_window_lock;
+    const archive_index*                m_sidecar;
 
 public:
     typedef std::vector<entry> content_type;
@@ -60,13 +129,67 @@ public:
     unsigned count () const { return m_count; }
     const uint32_t* header () const { return m_header.begin(); }
 
+    uint32_t entry_id (unsigned seq) const { return bin::little_dword (header()[seq*4]); }
+    uint32_t entry_offset (unsigned seq) const { return bin::little_dword (header()[seq*4+1]); }
+    size_t entry_size (unsigned seq) const
+    {
+        const uint32_t* entry = header() + seq * 4;
+        size_t packed_size = bin::little_dword (entry[3]);
+        return packed_size ? packed_size : bin::little_dword (entry[2]);
+    }
+
+    // get data of the entry number SEQ as it is stored in archive.  could be called
+    // concurrently.
+    archive_span span (unsigned seq) const;
+
+    // determine type of the entry number SEQ without unpacking it.
+    entry_type classify (unsigned seq) const;
+
+    // use previously built INDEX to answer classify() queries instead of reading archive.
+    // index should stay alive while reader is used.
+    void set_index (const archive_index* index) { m_sidecar = index; }
+
+    // hint the system that archive data in the range [OFFSET, OFFSET+SIZE) will be
+    // accessed soon.  does nothing if that range isn't currently mapped.
+    void advise (size_t offset, size_t size) const;
+    // hint the system that archive data will be read sequentially.
+    void advise_sequential () const;
+
+    // find sequence number of the entry with identifier ID.
+    // Returns: FALSE if there's no such entry in archive.
+    bool find (uint32_t id, unsigned& seq) const;
+
     void read_content (content_type& content);
 
     size_t copy_to (unsigned seq, std::ostream& out);
+
+#ifdef __linux__
+    // copy SIZE bytes at OFFSET of archive into file descriptor FD at DEST_OFFSET without
+    // passing them through user space.
+    // Returns: number of bytes copied, less than SIZE if kernel refused to copy the rest.
+    size_t copy_range (uint64_t offset, size_t size, int fd, uint64_t dest_offset) const;
+#endif
+
+    static const size_t max_whole_mapping = sizeof(void*) > 4 ? ~size_t(0) : 512 << 20;
+    static const size_t window_size = 64 << 20;
+
+private:
+    void build_index ();
+    void map_data ();
+
+    file_reader (const file_reader&);               // not defined
+    file_reader& operator= (const file_reader&);
 };
 
 void write_ami_header (const file_reader::content_type& content, std::ostream& out);
-void write_ami_entry (const file_info& file, entry& entry, std::ostream& out);
+void write_ami_entry (const file_info& file, entry& entry, std::ostream& out,
+                      deflate_params& params, ext::tostream& log = TCLOG);
+
+// same as above, but entries compiled in memory, i.e. scripts, are left in IMAGE instead
+// of being written into OUT.
+// Returns: TRUE if entry data was put into IMAGE.
+bool write_ami_entry (const file_info& file, entry& entry, std::ostream& out,
+                      std::vector<char>& image, deflate_params& params, ext::tostream& log);
 
 class converter
 {
@@ -77,6 +200,28 @@ public:
     bool write_script (uint32_t id, const char* scr_data, size_t size);
     bool write_image (uint32_t id, const char* grp_data, size_t size);
 
+    // compressed entries of types for which keeps_packed() returns TRUE aren't inflated
+    // by extractor, but passed to write_packed as they're stored in archive.  raw entries
+    // are still inflated by the worker threads when extraction is performed in parallel,
+    // and passed to write_raw.  both methods are called from the writer thread.
+    bool keeps_packed (entry_type type) const { return entry_raw == type; }
+    bool write_packed (uint32_t id, entry_type type, const char* zdata, size_t zsize,
+                       size_t unpacked_size);
+
+    // entries of types not accepted by writer are passed to skip() without being read
+    // from archive.  accepts() could be called from worker threads.
+    bool accepts (entry_type) const { return true; }
+    bool skip (uint32_t, entry_type) { return true; }
+
+    // convert_* methods are called from worker threads and put converted file contents
+    // into OUT.  FALSE return value means that entry should be passed to corresponding
+    // write_* method instead.
+    bool convert_script (uint32_t id, const char* scr_data, size_t size, std::vector<char>& out) const;
+    bool convert_image (uint32_t id, const char* grp_data, size_t size, std::vector<char>& out) const;
+
+    // write data previously produced by convert_* methods.
+    bool write_converted (uint32_t id, entry_type type, const char* data, size_t size);
+
     enum action
     {
         action_abort,
@@ -85,29 +230,104 @@ public:
     };
 };
 
+// Writer class should implement the same methods as converter above.  when extraction
+// is performed in parallel, convert_* methods are invoked concurrently from worker threads,
+// while write_* methods are always called from the thread that called extract(), in the
+// order of archive entries.
+
+enum extract_schedule
+{
+    schedule_toc,       // in the order of archive table of contents
+    schedule_offset,    // in the order of entries data within archive file
+};
+
 template <class Writer>
 class extractor : public file_reader
 {
     Writer              m_writer;
+    unsigned            m_workers;
+    unsigned            m_queue_depth;
+    size_t              m_memory_budget;
+    extract_schedule    m_schedule;
+    size_t              m_bytes_read;
+    double              m_elapsed;
 
 public:
     template <typename CharT>
     explicit extractor (const CharT* filename)
-        : file_reader (filename), m_writer()
+        : file_reader (filename), m_writer(), m_workers (1)
+        , m_queue_depth (default_queue_depth), m_memory_budget (default_memory_budget)
+        , m_schedule (schedule_offset), m_bytes_read (0), m_elapsed (0)
     { }
 
     template <typename CharT, class Arg>
     extractor (const CharT* filename, const Arg& arg)
-        : file_reader (filename), m_writer (arg)
+        : file_reader (filename), m_writer (arg), m_workers (1)
+        , m_queue_depth (default_queue_depth), m_memory_budget (default_memory_budget)
+        , m_schedule (schedule_offset), m_bytes_read (0), m_elapsed (0)
     { }
 
+    template <typename CharT, class Arg1, class Arg2>
+    extractor (const CharT* filename, const Arg1& arg1, const Arg2& arg2)
+        : file_reader (filename), m_writer (arg1, arg2), m_workers (1)
+        , m_queue_depth (default_queue_depth), m_memory_budget (default_memory_budget)
+        , m_schedule (schedule_offset), m_bytes_read (0), m_elapsed (0)
+    { }
+
+    static const unsigned default_queue_depth = 32;
+    static const size_t default_memory_budget = 256 << 20;
+    // amount of data hinted to the system ahead of the reader.
+    static const size_t readahead_size = 8 << 20;
+
+    // set number of threads in each of the inflate and encode stages of extract().  zero
+    // means number of available CPU cores, 1 turns parallel extraction off.
+    void set_workers (unsigned count);
+    unsigned workers () const { return m_workers; }
+
+    // maximum number of entries waiting between pipeline stages.
+    void set_queue_depth (unsigned depth) { m_queue_depth = depth ? depth : 1; }
+
+    // approximate limit of memory held by entries in flight, in bytes.
+    void set_memory_budget (size_t size) { m_memory_budget = size; }
+
+    // order in which extract() processes archive entries.  output is the same either way,
+    // offset order makes archive reads sequential.
+    void set_schedule (extract_schedule order) { m_schedule = order; }
+
+    // amount of archive data read by the last extract() call and its duration in seconds.
+    size_t bytes_read () const { return m_bytes_read; }
+    double elapsed () const { return m_elapsed; }
+
     unsigned extract ();
     bool extract (uint32_t id);
 
+    // extract entries with identifiers listed in IDS in the order they're stored in
+    // archive.  identifiers not found in archive are ignored.
+    // Returns: number of extracted entries.
+    unsigned extract (const std::vector<uint32_t>& ids);
+
     const Writer& writer () const { return m_writer; }
 
 private:
     bool extract_entry (unsigned seq);
+    unsigned extract_serial (const std::vector<unsigned>& order);
+    unsigned extract_parallel (const std::vector<unsigned>& order);
+
+    bool is_filtered () const;
+    bool skip_entry (unsigned seq, entry_type& type) const;
+    void build_schedule (std::vector<unsigned>& order) const;
+    unsigned readahead (const std::vector<unsigned>& order, unsigned pos) const;
+
+    // raw entries are inflated by the worker threads in parallel pipeline, so that
+    // writer thread is left with file output only.
+    bool is_kept_packed (entry_type type) const
+        { return entry_raw != type && m_writer.keeps_packed (type); }
+
+    size_t entry_cost (unsigned seq, entry_type type) const;
+    void read_job (extract_job& job) const;
+    void inflate_job (extract_job& job) const;
+    void encode_job (extract_job& job) const;
+    bool commit_job (extract_job& job);
 
     std::vector<char>       m_out_data;
 };
@@ -116,11 +336,14 @@ template <typename CharT> file_reader::
 file_reader (const CharT* filename)
     : m_in (filename)
     , m_header (m_in, 0, 4)
+    , m_sidecar (0)
 {
     if (bin::little_dword (m_header[0]) != 0x494d41) // 'AMI'
         throw sys::file_error (filename, _T("file format not recognized"));
     m_count = bin::little_dword (m_header[1]);
     m_header.remap (m_in, 0x10, m_count*4);
+    build_index();
+    map_data();
 }
 
 } // namespace xami
@@ -0,0 +1,187 @@
+// -*- C++ -*-
+//! \file       ami-cache.cc
+//! \date       Sat Oct 17 19:05:12 2026
+//! \brief      persistent cache of compiled archive entries.
+//
+// Copyright (C) 2014 morkt and the MuvLuvRu project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+
+#include "ami-cache.hpp"
+#include "fileutil.hpp"
+#include "binio.h"
+#include <zlib.h>
+
+namespace xami {
+
+namespace {
+
+const uint32_t cache_signature = 0x43494d41; // 'AMIC'
+// should be changed whenever write_ami_entry produces different output for the same file.
+const uint32_t cache_version = 4;
+const size_t cache_header_size = 3;     // in dwords
+const size_t cache_record_size = 11;
+
+} // anonymous namespace
+
+cache_key
+make_cache_key (uint32_t id, const file_info& file, compression_preset preset)
+{
+    sys::mapping::readonly in (file.name);
+    sys::mapping::const_view<Bytef> data (in);
+    cache_key key;
+    key.id = id;
+    key.type = file.type;
+    key.size = data.size();
+    key.crc = crc32 (0, data.begin(), data.size());
+    key.adler = adler32 (1, data.begin(), data.size());
+    key.preset = preset;
+    return key;
+}
+
+entry_cache::
+~entry_cache ()
+{
+    close();
+    if (!m_new_name.empty())
+        ext::delete_file (m_new_name.c_str());
+}
+
+bool entry_cache::
+open (const tstring& archive_name)
+{
+    m_name = sidecar_name (archive_name);
+    m_new_name = m_name + _T(".new");
+    if (!load())
+        close();
+    m_out.open (m_new_name, std::ios::out|std::ios::trunc|std::ios::binary);
+    if (!m_out)
+        return false;
+    m_out.seekp (cache_header_size * 4);
+    m_count = 0;
+    return true;
+}
+
+bool entry_cache::
+load ()
+{
+    if (!ext::file_exists (m_name.c_str()))
+        return false;
+    m_file.reset (new sys::mapping::readonly (m_name));
+    if (m_file->size() < cache_header_size * 4)
+        return false;
+    m_view.reset (new sys::mapping::const_view<char> (*m_file));
+    const char* data = m_view->begin();
+    const char* const end = m_view->end();
+    const uint32_t* header = reinterpret_cast<const uint32_t*> (data);
+    if (bin::little_dword (header[0]) != cache_signature
+        || bin::little_dword (header[1]) != cache_version)
+        return false;
+    unsigned count = bin::little_dword (header[2]);
+    data += cache_header_size * 4;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (size_t (end - data) < cache_record_size * 4)
+            return false;
+        const uint32_t* fields = reinterpret_cast<const uint32_t*> (data);
+        cache_record record;
+        record.key.id           = bin::little_dword (fields[0]);
+        record.key.type         = static_cast<file_type> (bin::little_dword (fields[1]));
+        record.key.size         = bin::little_dword (fields[2]);
+        record.key.crc          = bin::little_dword (fields[3]);
+        record.key.adler        = bin::little_dword (fields[4]);
+        record.key.preset       = static_cast<compression_preset> (bin::little_dword (fields[5]));
+        record.unpacked_size    = bin::little_dword (fields[6]);
+        record.packed_size      = bin::little_dword (fields[7]);
+        record.params.level     = static_cast<int> (bin::little_dword (fields[8]));
+        record.params.strategy  = static_cast<int> (bin::little_dword (fields[9]));
+        record.size             = bin::little_dword (fields[10]);
+        data += cache_record_size * 4;
+        if (record.key.preset > compression_auto || size_t (end - data) < record.size)
+            return false;
+        record.data = data;
+        data += record.size;
+        m_records[record.key.id] = record;
+    }
+    return true;
+}
+
+const cache_record* entry_cache::
+find (const cache_key& key) const
+{
+    auto it = m_records.find (key.id);
+    if (it == m_records.end() || !(it->second.key == key))
+        return 0;
+    return &it->second;
+}
+
+const cache_record* entry_cache::
+find_tuned (uint32_t id) const
+{
+    auto it = m_records.find (id);
+    if (it == m_records.end() || compression_auto != it->second.key.preset)
+        return 0;
+    return &it->second;
+}
+
+void entry_cache::
+add (const cache_key& key, const entry& ent, const deflate_params& params,
+     const char* data, size_t size)
+{
+    bin::write32bit (m_out, key.id);
+    bin::write32bit (m_out, static_cast<uint32_t> (key.type));
+    bin::write32bit (m_out, key.size);
+    bin::write32bit (m_out, key.crc);
+    bin::write32bit (m_out, key.adler);
+    bin::write32bit (m_out, static_cast<uint32_t> (key.preset));
+    bin::write32bit (m_out, ent.unpacked_size);
+    bin::write32bit (m_out, ent.packed_size);
+    bin::write32bit (m_out, static_cast<uint32_t> (params.level));
+    bin::write32bit (m_out, static_cast<uint32_t> (params.strategy));
+    bin::write32bit (m_out, size);
+    m_out.write (data, size);
+    ++m_count;
+}
+
+void entry_cache::
+close ()
+{
+    m_records.clear();
+    m_view.reset();
+    m_file.reset();
+}
+
+bool entry_cache::
+commit ()
+{
+    m_out.seekp (0, std::ios::beg);
+    bin::write32bit (m_out, cache_signature);
+    bin::write32bit (m_out, cache_version);
+    bin::write32bit (m_out, m_count);
+    m_out.close();
+    // cache file should be unmapped before it could be replaced
+    close();
+    if (m_out.fail() || !ext::replace_file (m_new_name.c_str(), m_name.c_str()))
+        return false;
+    m_new_name.clear();
+    return true;
+}
+
+} // namespace xami
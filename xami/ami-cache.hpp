@@ -0,0 +1,125 @@
+// -*- C++ -*-
+//! \file       ami-cache.hpp
+//! \date       Sat Oct 17 19:05:12 2026
+//! \brief      persistent cache of compiled archive entries.
+//
+// Copyright (C) 2014 morkt and the MuvLuvRu project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+
+#ifndef AMI_CACHE_HPP
+#define AMI_CACHE_HPP
+
+#include <map>
+#include <memory>
+#include <fstream>
+#include "ami-archive.hpp"
+
+namespace xami {
+
+// identifies contents of the source file put into archive entry.
+struct cache_key
+{
+    uint32_t    id;
+    file_type   type;
+    uint32_t    size;
+    uint32_t    crc;            // CRC32 of the file contents
+    uint32_t    adler;          // Adler-32 of the file contents
+    compression_preset preset;
+
+    cache_key () : id (0), type (file_raw), size (0), crc (0), adler (0)
+                 , preset (compression_max) { }
+
+    bool operator== (const cache_key& other) const
+    {
+        return id == other.id && type == other.type && size == other.size
+            && crc == other.crc && adler == other.adler && preset == other.preset;
+    }
+};
+
+// compute key of the FILE that becomes entry ID when compressed with PRESET.
+cache_key make_cache_key (uint32_t id, const file_info& file, compression_preset preset);
+
+// entry compiled during previous archive creation.
+struct cache_record
+{
+    cache_key   key;
+    size_t      unpacked_size;
+    size_t      packed_size;
+    deflate_params params;      // parameters the entry was compressed with
+    const char* data;
+    size_t      size;
+};
+
+// compiled entries stored in the file alongside the archive.  previous contents of the
+// cache are available for lookups while new cache is written, and replace it on commit,
+// so cache keeps only entries of the last created archive.
+class entry_cache
+{
+public:
+    entry_cache () : m_count (0) { }
+    ~entry_cache ();
+
+    // load existing cache of ARCHIVE_NAME and start writing the new one.
+    // Returns: FALSE if new cache couldn't be created.
+    bool open (const tstring& archive_name);
+
+    // safe to call from multiple threads.
+    // Returns: compiled entry matching KEY, or NULL if there's none.
+    const cache_record* find (const cache_key& key) const;
+
+    // safe to call from multiple threads.
+    // Returns: auto-tuned entry ID regardless of its contents, or NULL if there's none.
+    const cache_record* find_tuned (uint32_t id) const;
+
+    // put entry ENT compiled from the file identified by KEY with PARAMS into the new
+    // cache.
+    void add (const cache_key& key, const entry& ent, const deflate_params& params,
+              const char* data, size_t size);
+
+    // replace existing cache with the new one.
+    // Returns: FALSE if new cache couldn't be written.
+    bool commit ();
+
+    // name of the cache file for archive ARCHIVE_NAME.
+    static tstring sidecar_name (const tstring& archive_name) { return archive_name + _T(".cache"); }
+
+private:
+    bool load ();
+    void close ();
+
+    tstring                     m_name;
+    tstring                     m_new_name;
+    std::unique_ptr<sys::mapping::readonly>
+                                m_file;
+    std::unique_ptr<sys::mapping::const_view<char>>
+                                m_view;
+    std::map<uint32_t, cache_record>
+                                m_records;  // keyed by entry id
+    std::ofstream               m_out;
+    unsigned                    m_count;    // number of records in the new cache
+
+    entry_cache (const entry_cache&);       // not defined
+    entry_cache& operator= (const entry_cache&);
+};
+
+} // namespace xami
+
+#endif /* AMI_CACHE_HPP */
@@ -0,0 +1,328 @@
+// -*- C++ -*-
+//! \file       ami-convert.cc
+//! \date       Sat Oct 17 16:58:34 2026
+//! \brief      archive entries conversion into files.
+//
+// Copyright (C) 2014 morkt and the MuvLuvRu project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+
+#include "ami-convert.hpp"
+#include "fileutil.hpp"
+#include <sstream>
+#include <iomanip>
+
+namespace xami {
+
+file_converter::action file_converter::
+open_stream (std::ofstream& out, const tstring& filename, bool text_mode)
+{
+    action rc = check_overwrite (filename);
+    if (action_ok != rc)
+        return rc;
+    std::ios::openmode ios_mode = std::ios::out|std::ios::trunc;
+    if (!text_mode)
+        ios_mode |= std::ios::binary;
+    out.open (filename, ios_mode);
+    if (!out)
+    {
+        int err = last_error();
+        TCLOG << filename << _T(": ") << get_error_text (err);
+        return action_skip;
+    }
+    return action_ok;
+}
+
+template <class Writer>
+file_converter::action file_converter::
+write_file (uint32_t id, const TCHAR* ext, Writer writer, bool text_mode)
+{
+    tstring filename = format_filename (id, ext);
+    if (!m_progress->next (filename))
+        return action_abort;
+    std::ofstream out;
+    action rc = open_stream (out, filename, text_mode);
+    if (action_ok != rc)
+        return rc;
+    return writer (out) ? action_ok : action_failed;
+}
+
+bool file_converter::
+write_raw (uint32_t id, const char* buffer, size_t size)
+{
+    if (action_abort == write_file (id, _T("dat"), [=] (std::ostream& out) -> bool {
+            return bool (out.write (buffer, size)); }))
+        return false;
+    return true;
+}
+
+bool file_converter::
+write_packed (uint32_t id, entry_type type, const char* zdata, size_t zsize,
+              size_t unpacked_size)
+{
+    if (entry_image != type)
+    {
+        if (action_abort == write_file (id, _T("dat"), [=] (std::ostream& out) -> bool {
+                xami::stream_inflate (zdata, zsize, out);
+                return bool (out); }))
+            return false;
+        return true;
+    }
+    tstring filename;
+    action rc = check_image_file (id, filename);
+    if (action_abort == rc)
+        return false;
+    if (action_ok == rc)
+    {
+        xami::write_zgrp (filename, zdata, zsize, unpacked_size);
+        ++m_images_count;
+    }
+    return true;
+}
+
+bool file_converter::
+write_script (uint32_t id, const char* scr_data, size_t size)
+{
+    if (m_options.extract_texts)
+    {
+        action rc;
+        switch (m_options.script_format)
+        {
+        default:
+        case file_mlt:  rc = write_file (id, _T("mlt"), [=] (std::ostream& out) {
+                            return xami::write_script_mlt (out, id, scr_data, size, m_options.encoding);
+                        }, true);
+                        break;
+        case file_txt:  rc = write_file (id, _T("txt"), [=] (std::ostream& out) {
+                            return xami::write_script_txt (out, id, scr_data, size, m_options.encoding);
+                        }, true);
+                        break;
+        case file_xml:  rc = write_file (id, _T("xml"), [=] (std::ostream& out) {
+                            return xami::write_script_xml (out, id, scr_data, size, m_options.encoding);
+                        }, true);
+                        break;
+        }
+        if (action_abort == rc)
+            return false;
+        if (action_ok == rc)
+            ++m_script_count;
+    }
+    else
+        m_progress->step();
+    return true;
+}
+
+bool file_converter::
+accepts (entry_type type) const
+{
+    switch (type)
+    {
+    case entry_script:  return m_options.extract_texts;
+    case entry_image:   return m_options.extract_images;
+    default:            return true;
+    }
+}
+
+bool file_converter::
+keeps_packed (entry_type type) const
+{
+    // images requested in ZGRP format are written as they're stored in archive
+    return entry_raw == type || (entry_image == type && file_zgrp == m_options.image_format);
+}
+
+const TCHAR* file_converter::
+script_ext () const
+{
+    switch (m_options.script_format)
+    {
+    default:
+    case file_mlt:  return _T("mlt");
+    case file_txt:  return _T("txt");
+    case file_xml:  return _T("xml");
+    }
+}
+
+bool file_converter::
+convert_script (uint32_t id, const char* scr_data, size_t size, std::vector<char>& out) const
+{
+    if (!m_options.extract_texts || !xami::check_script (scr_data, size))
+        return false;
+    std::ostringstream text;
+    bool rc;
+    switch (m_options.script_format)
+    {
+    default:
+    case file_mlt:  rc = xami::write_script_mlt (text, id, scr_data, size, m_options.encoding); break;
+    case file_txt:  rc = xami::write_script_txt (text, id, scr_data, size, m_options.encoding); break;
+    case file_xml:  rc = xami::write_script_xml (text, id, scr_data, size, m_options.encoding); break;
+    }
+    if (!rc)
+        return false;
+    const std::string& str = text.str();
+    out.assign (str.begin(), str.end());
+    return true;
+}
+
+bool file_converter::
+convert_image (uint32_t, const char* grp_data, size_t size, std::vector<char>& out) const
+{
+    // raw GRP images are written as is, there's nothing to convert
+    if (!m_options.extract_images || file_png != m_options.image_format)
+        return false;
+    return xami::encode_png (grp_data, size, out);
+}
+
+file_converter::action file_converter::
+check_overwrite (const tstring& filename)
+{
+    if (!ext::file_exists (filename.c_str()))
+        return action_ok;
+    switch (m_options.overwrite)
+    {
+    case overwrite_always:
+        return action_ok;
+    case overwrite_never:
+        TCLOG << filename << _T(": ") << get_error_text (error_file_exists);
+        return action_skip;
+    default:
+        break;
+    }
+    bool apply_to_all = false;
+    overwrite_answer answer = m_progress->confirm_overwrite (filename, apply_to_all);
+    if (overwrite_cancel == answer)
+        return action_abort;
+    if (apply_to_all)
+        m_options.overwrite = overwrite_yes == answer ? overwrite_always : overwrite_never;
+    return overwrite_yes == answer ? action_ok : action_skip;
+}
+
+file_converter::action file_converter::
+check_image_file (uint32_t id, tstring& filename)
+{
+    const TCHAR* ext = file_png == m_options.image_format ? _T("png")
+                     : file_zgrp == m_options.image_format ? _T("zgrp") : _T("grp");
+    filename = format_filename (id, ext);
+    if (!m_progress->next (filename))
+        return action_abort;
+    return check_overwrite (filename);
+}
+
+bool file_converter::
+write_image (uint32_t id, const char* grp_data, size_t size)
+{
+    if (m_options.extract_images)
+    {
+        tstring filename;
+        action rc = check_image_file (id, filename);
+        if (action_abort == rc)
+            return false;
+        if (action_ok != rc)
+            return true;
+        if (file_png == m_options.image_format)
+            xami::write_png (filename, grp_data, size);
+        else
+            xami::write_raw (filename, grp_data, size);
+        ++m_images_count;
+    }
+    else
+        m_progress->step();
+    return true;
+}
+
+bool file_converter::
+write_converted (uint32_t id, entry_type type, const char* data, size_t size)
+{
+    if (entry_image == type)
+    {
+        tstring filename;
+        action rc = check_image_file (id, filename);
+        if (action_abort == rc)
+            return false;
+        if (action_ok == rc)
+        {
+            xami::write_raw (filename, data, size);
+            ++m_images_count;
+        }
+    }
+    else if (entry_script == type)
+    {
+        action rc = write_file (id, script_ext(), [=] (std::ostream& out) -> bool {
+            return bool (out.write (data, size)); }, true);
+        if (action_abort == rc)
+            return false;
+        if (action_ok == rc)
+            ++m_script_count;
+    }
+    else
+        return write_raw (id, data, size);
+    return true;
+}
+
+void
+extraction_report (int total, const file_converter& writer)
+{
+    int count = writer.count();
+    if (1 == count)
+    {
+        TCLOG << _T("1 file extracted");
+        if (writer.scripts())
+            TCLOG << _T(" (script)");
+        else if (writer.images())
+            TCLOG << _T(" (image)");
+    }
+    else if (count > 1)
+    {
+        if (count != total)
+            TCLOG << count << _T(" of ") << total << _T(" files extracted");
+        else
+        {
+            TCLOG << count << _T(" files extracted");
+            int items = 0;
+            if (writer.scripts())
+            {
+                TCLOG << _T(" (") << writer.scripts() << _T(" scripts");
+                ++items;
+            }
+            if (writer.images())
+            {
+                if (items) TCLOG << _T(", ");
+                else       TCLOG << _T(" (");
+                TCLOG << writer.images() << _T(" images)");
+            }
+            else if (items) TCLOG << _T(')');
+        }
+    }
+    else
+        TCLOG << _T("No files extracted");
+    TCLOG << _T(".\n");
+}
+
+void
+throughput_report (size_t bytes, double seconds)
+{
+    if (!bytes || seconds <= 0)
+        return;
+    const double megabytes = bytes / 1048576.0;
+    TCLOG << std::fixed << std::setprecision (1) << megabytes << _T(" MB read in ")
+          << seconds << _T(" s (") << megabytes / seconds << _T(" MB/s).\n");
+    TCLOG.unsetf (std::ios::floatfield);
+}
+
+} // namespace xami
@@ -0,0 +1,119 @@
+// -*- C++ -*-
+//! \file       ami-convert.hpp
+//! \date       Sat Oct 17 16:55:12 2026
+//! \brief      archive entries conversion into files.
+//
+// Copyright (C) 2014 morkt and the MuvLuvRu project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+
+#ifndef AMI_CONVERT_HPP
+#define AMI_CONVERT_HPP
+
+#include <fstream>
+#include "ami-archive.hpp"
+#include "task-progress.hpp"
+
+namespace xami {
+
+enum overwrite_mode
+{
+    overwrite_ask,          // ask task_progress about every existing file
+    overwrite_always,
+    overwrite_never,
+};
+
+struct extract_options
+{
+    bool            extract_texts;
+    bool            extract_images;
+    file_type       script_format;  // file_mlt, file_txt or file_xml
+    file_type       image_format;   // file_png, file_grp or file_zgrp
+    encoding_id     encoding;
+    overwrite_mode  overwrite;
+
+    extract_options ()
+        : extract_texts (true), extract_images (true), script_format (file_mlt)
+        , image_format (file_png), encoding (enc_default), overwrite (overwrite_ask)
+    { }
+};
+
+// writer for extractor class that puts archive entries into files within current
+// directory.
+class file_converter : public converter
+{
+public:
+    file_converter (task_progress* progress, const extract_options& options)
+        : m_progress (progress), m_options (options), m_script_count (0), m_images_count (0)
+    { }
+
+    bool write_raw (uint32_t id, const char* buffer, size_t size);
+    bool write_script (uint32_t id, const char* scr_data, size_t size);
+    bool write_image (uint32_t id, const char* grp_data, size_t size);
+    bool write_packed (uint32_t id, entry_type type, const char* zdata, size_t zsize,
+                       size_t unpacked_size);
+
+    bool convert_script (uint32_t id, const char* scr_data, size_t size, std::vector<char>& out) const;
+    bool convert_image (uint32_t id, const char* grp_data, size_t size, std::vector<char>& out) const;
+    bool write_converted (uint32_t id, entry_type type, const char* data, size_t size);
+
+    bool accepts (entry_type type) const;
+    bool keeps_packed (entry_type type) const;
+    bool skip (uint32_t, entry_type) { m_progress->step(); return true; }
+
+    unsigned scripts () const { return m_script_count; }
+    unsigned images () const { return m_images_count; }
+
+    unsigned count () const { return m_script_count + m_images_count; }
+
+    enum action
+    {
+        action_ok,
+        action_skip,
+        action_abort,
+        action_failed,
+    };
+
+private:
+    template <class Writer>
+    action write_file (uint32_t id, const TCHAR* ext, Writer writer, bool text_mode = false);
+
+    action open_stream (std::ofstream& out, const tstring& filename, bool text_mode = false);
+
+    action check_overwrite (const tstring& filename);
+
+    action check_image_file (uint32_t id, tstring& filename);
+
+    const TCHAR* script_ext () const;
+
+private:
+    task_progress*      m_progress;
+    extract_options     m_options;
+    unsigned            m_script_count;
+    unsigned            m_images_count;
+};
+
+// write summary of the extraction into log.
+void extraction_report (int total, const file_converter& writer);
+void throughput_report (size_t bytes, double seconds);
+
+} // namespace xami
+
+#endif /* AMI_CONVERT_HPP */
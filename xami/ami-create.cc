@@ -0,0 +1,1190 @@
+// -*- C++ -*-
+//! \file       ami-create.cc
+//! \date       Sat Oct 17 17:12:40 2026
+//! \brief      AMI archive creation implementation.
+//
+// Copyright (C) 2014 morkt and the MuvLuvRu project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+
+#include "ami-create.hpp"
+#include "ami-cache.hpp"
+#include "mltcomp.hpp"
+#include "fileutil.hpp"
+#include "tregex.hpp"
+#include "work-queue.hpp"
+#include "binio.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <exception>
+#include <atomic>
+#include <cstring>
+#include <cassert>
+#include <zlib.h>
+#ifdef _WIN32
+#include "syshandle.h"
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cstdlib>
+#endif
+
+namespace xami {
+
+using ext::tregex;
+
+// upper limit of memory held by the entries compiled in advance of the writer.
+const size_t pack_memory_budget = 256 * 1024 * 1024;
+
+// scripts are parsed right from the mapped file.
+static bool
+read_script (mlt_compiler& script, const file_info& input)
+{
+    sys::mapping::readonly in (input.name);
+    sys::mapping::const_view<char> data (in);
+    return script.read_data (data.begin(), data.size());
+}
+
+// TXT scripts are usually read by build_file_table already.
+static bool
+read_script (scr_compiler& script, const file_info& input)
+{
+    if (input.contents)
+        return script.read_data (input.contents->data(), input.contents->size());
+    sys::mapping::readonly in (input.name);
+    sys::mapping::const_view<char> data (in);
+    return script.read_data (data.begin(), data.size());
+}
+
+template <class ScriptCompiler> size_t
+convert_script (const file_info& input, std::vector<char>& image, ext::tostream& log)
+{
+    ScriptCompiler script;
+    script.set_filename (input.name);
+    script.set_log (log);
+    if (!read_script (script, input))
+    {
+        image.clear();
+        return 0;
+    }
+    return script.compile_data (image);
+}
+
+void
+write_ami_header (const file_reader::content_type& content, std::ostream& out)
+{
+    assert (!content.empty() && "Empty AMI archive");
+    out.write ("AMI", 4);
+    bin::write32bit (out, content.size());
+    // entries data starts right after the table of contents
+    bin::write32bit (out, content.size() * 16 + 16);
+    bin::write32bit (out, 0u);
+    for (auto it = content.begin(); it != content.end(); ++it)
+    {
+        bin::write32bit (out, it->id);
+        bin::write32bit (out, it->offset);
+        bin::write32bit (out, it->unpacked_size);
+        bin::write32bit (out, it->packed_size);
+    }
+}
+
+bool
+write_ami_entry (const xami::file_info& file, xami::entry& entry, std::ostream& out,
+                 std::vector<char>& image, deflate_params& params, ext::tostream& log)
+{
+    switch (file.type)
+    {
+    case xami::file_png:
+        entry.unpacked_size = xami::convert_png (file.name, out, entry.packed_size, params, log);
+        break;
+    case xami::file_grp:
+        entry.unpacked_size = xami::deflate_file (file.name, out, entry.packed_size, params);
+        break;
+    case xami::file_zgrp:
+        entry.unpacked_size = xami::copy_zgrp (file.name, out);
+        entry.packed_size = file.size - xami::ZGRP_HEADER_SIZE;
+        break;
+    case xami::file_mlt:
+        entry.unpacked_size = convert_script<mlt_compiler> (file, image, log);
+        entry.packed_size = 0;
+        return true;
+    case xami::file_txt:
+        entry.unpacked_size = convert_script<scr_compiler> (file, image, log);
+        entry.packed_size = 0;
+        return true;
+    default:
+        entry.unpacked_size = xami::copy_file (file.name, out);
+        entry.packed_size = 0;
+    }
+    return false;
+}
+
+void
+write_ami_entry (const xami::file_info& file, xami::entry& entry, std::ostream& out,
+                 deflate_params& params, ext::tostream& log)
+{
+    std::vector<char> image;
+    if (write_ami_entry (file, entry, out, image, params, log) && !image.empty())
+        out.write (image.data(), image.size());
+}
+
+namespace {
+
+// archive entry compiled by the worker thread into memory buffer.
+struct pack_job
+{
+    unsigned            pos;
+    size_t              cost;       // memory reserved for this entry
+    const file_info*    file;       // NULL if entry is copied from the source archive
+    entry               info;
+    std::stringstream   data;
+    std::vector<char>   image;      // compiled script, kept apart from DATA
+    ext::tostringstream log;
+    std::exception_ptr  error;
+    cache_key           key;
+    const cache_record* cached;     // entry found in cache, if any
+    deflate_params      params;
+    unsigned            threads;    // number of threads deflating large entry
+
+    pack_job () : pos (0), cost (0), file (0), info (), cached (0), threads (1) { }
+};
+
+typedef std::unique_ptr<pack_job> pack_job_ptr;
+
+// compile JOB with compression PRESET, unless it's found in CACHE.  parameters chosen
+// for the entry by the previous auto-tuning are reused, even if its file has changed.
+// large entries are deflated by JOB.threads threads.
+void
+compile_job (pack_job& job, const entry_cache* cache, compression_preset preset)
+{
+    try
+    {
+        job.params = get_compression_params (preset);
+        job.params.threads = job.threads;
+        if (cache)
+        {
+            job.key = make_cache_key (job.info.id, *job.file, preset);
+            job.cached = cache->find (job.key);
+            const cache_record* tuned;
+            if (!job.cached && job.params.tune && (tuned = cache->find_tuned (job.info.id)))
+            {
+                job.params = tuned->params;
+                job.params.threads = job.threads;
+            }
+        }
+        if (job.cached)
+        {
+            job.info.unpacked_size = job.cached->unpacked_size;
+            job.info.packed_size = job.cached->packed_size;
+            job.params = job.cached->params;
+        }
+        else
+            write_ami_entry (*job.file, job.info, job.data, job.image, job.params, job.log);
+    }
+    catch (...)
+    {
+        job.error = std::current_exception();
+    }
+}
+
+// entries data written into archive, looked up by contents so that identical entries
+// could share it.
+class blob_table
+{
+public:
+    explicit blob_table (const tstring& output) : m_output (output), m_saved (0) { }
+
+    // look for the entry written before with the same sizes as ENT and contents DATA, and
+    // point ENT to it.  otherwise DATA is remembered as written at ENT offset.
+    // Returns: TRUE if ENT shares data with another entry.
+    bool share (const char* data, size_t size, std::ostream& out, entry& ent);
+
+    // number of bytes that weren't written due to sharing.
+    uint64_t saved () const { return m_saved; }
+
+private:
+    bool is_written (const char* data, size_t size, uint32_t offset, std::ostream& out);
+
+    typedef std::multimap<uint32_t, entry> blob_map;    // keyed by CRC32 of the data
+
+    tstring         m_output;
+    std::ifstream   m_in;       // reads back written data to compare it
+    blob_map        m_blobs;
+    uint64_t        m_saved;
+};
+
+bool blob_table::
+share (const char* data, size_t size, std::ostream& out, entry& ent)
+{
+    if (!size)
+        return false;
+    uint32_t crc = crc32 (0, reinterpret_cast<const Bytef*> (data), size);
+    auto range = m_blobs.equal_range (crc);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        const entry& blob = it->second;
+        if (blob.unpacked_size == ent.unpacked_size && blob.packed_size == ent.packed_size
+            && is_written (data, size, blob.offset, out))
+        {
+            ent.offset = blob.offset;
+            m_saved += size;
+            return true;
+        }
+    }
+    m_blobs.insert (std::make_pair (crc, ent));
+    return false;
+}
+
+bool blob_table::
+is_written (const char* data, size_t size, uint32_t offset, std::ostream& out)
+{
+    // checksums match, so compare actual contents.
+    out.flush();
+    if (!m_in.is_open())
+        m_in.open (m_output, std::ios::in|std::ios::binary);
+    m_in.clear();
+    std::vector<char> written (size);
+    return m_in.seekg (offset) && m_in.read (written.data(), size)
+        && 0 == std::memcmp (written.data(), data, size);
+}
+
+// write compiled JOB into OUT, updating sizes of the archive entry ENT, and put it into
+// CACHE.  if BLOBS is not NULL, data shared with the entries written before isn't
+// written again.  messages produced during compilation are passed into TCLOG, and
+// entries that produced any aren't cached, so that messages are repeated next time.
+void
+commit_job (pack_job& job, entry& ent, std::ostream& out, entry_cache* cache, blob_table* blobs)
+{
+    const tstring& messages = job.log.str();
+    if (!messages.empty())
+        TCLOG << messages;
+    if (job.error)
+        std::rethrow_exception (job.error);
+    ent.unpacked_size = job.info.unpacked_size;
+    ent.packed_size = job.info.packed_size;
+    if (!job.cached && !cache && !blobs)
+    {
+        if (!job.image.empty())
+            out.write (job.image.data(), job.image.size());
+        else if (job.data.tellp() > 0)
+            out << job.data.rdbuf();
+        return;
+    }
+    std::string compiled;
+    const char* data;
+    size_t size;
+    if (job.cached)
+    {
+        data = job.cached->data;
+        size = job.cached->size;
+    }
+    else if (!job.image.empty())
+    {
+        data = job.image.data();
+        size = job.image.size();
+    }
+    else
+    {
+        compiled = job.data.str();
+        data = compiled.data();
+        size = compiled.size();
+    }
+    if (!blobs || !blobs->share (data, size, out, ent))
+        out.write (data, size);
+    if (cache && (job.cached || messages.empty()))
+        cache->add (job.key, ent, job.params, data, size);
+}
+
+// compile FILES into CONTENT entries using WORKERS threads and call COMMIT (pos, job)
+// for each of them on the calling thread in the same order.  entries that are NULL
+// aren't compiled, and passed to COMMIT as is.
+// Returns: FALSE if COMMIT returned false.
+template <class Commit> bool
+pack_entries (const file_reader::content_type& content, const std::vector<const file_info*>& files,
+              const pack_options& options, const entry_cache* cache, Commit commit)
+{
+    const unsigned total = files.size();
+    unsigned workers = options.workers;
+    if (!workers)
+        workers = std::thread::hardware_concurrency();
+    if (workers <= 1)
+    {
+        for (unsigned pos = 0; pos < total; ++pos)
+        {
+            pack_job job;
+            job.pos = pos;
+            job.file = files[pos];
+            job.info.id = content[pos].id;
+            if (job.file)
+                compile_job (job, cache, options.compression);
+            if (!commit (pos, job))
+                return false;
+        }
+        return true;
+    }
+
+    // feeder admits files in order within memory budget, workers compile them into
+    // buffers, and calling thread commits buffers in the same order, so that entry
+    // offsets don't depend on the number of threads.
+    bounded_queue<pack_job_ptr> queue (workers * 2);
+    memory_budget budget (pack_memory_budget);
+
+    std::mutex done_lock;
+    std::condition_variable done_cond;
+    std::map<unsigned, pack_job_ptr> done;
+
+    auto complete = [&] (pack_job_ptr job)
+    {
+        std::lock_guard<std::mutex> guard (done_lock);
+        unsigned pos = job->pos;
+        done[pos] = std::move (job);
+        done_cond.notify_all();
+    };
+    // workers left idle by the last entries help to deflate them.
+    unsigned files_left = std::count_if (files.begin(), files.end(),
+                                         [] (const file_info* file) { return file != 0; });
+    auto feeder = [&] ()
+    {
+        for (unsigned pos = 0; pos < total; ++pos)
+        {
+            pack_job_ptr job (new pack_job);
+            job->pos = pos;
+            job->file = files[pos];
+            job->info.id = content[pos].id;
+            if (job->file)
+            {
+                job->cost = job->file->size;
+                if (files_left < workers)
+                    job->threads = workers / files_left;
+                --files_left;
+            }
+            if (!budget.acquire (job->cost))
+                break;
+            if (!job->file)
+                complete (std::move (job));
+            else if (!queue.push (std::move (job)))
+                break;
+        }
+        queue.close();
+    };
+    auto worker = [&] ()
+    {
+        pack_job_ptr job;
+        while (queue.pop (job))
+        {
+            compile_job (*job, cache, options.compression);
+            complete (std::move (job));
+        }
+    };
+
+    struct pipeline_guard
+    {
+        bounded_queue<pack_job_ptr>&    queue;
+        memory_budget&                  budget;
+        thread_group                    threads;
+
+        pipeline_guard (bounded_queue<pack_job_ptr>& q, memory_budget& m)
+            : queue (q), budget (m) { }
+        ~pipeline_guard ()
+        {
+            queue.cancel();
+            budget.cancel();
+            threads.join();
+        }
+    } pipeline (queue, budget);
+
+    pipeline.threads.create (1, feeder);
+    pipeline.threads.create (workers, worker);
+
+    for (unsigned pos = 0; pos < total; ++pos)
+    {
+        pack_job_ptr job;
+        {
+            std::unique_lock<std::mutex> guard (done_lock);
+            done_cond.wait (guard, [&] { return done.count (pos) != 0; });
+            job = std::move (done[pos]);
+            done.erase (pos);
+        }
+        bool result = commit (pos, *job);
+        budget.release (job->cost);
+        if (!result)
+            return false;
+    }
+    return true;
+}
+
+// copies entries of the source archive into output.  entries sharing data in the source
+// share it in the output as well.  on Linux adjacent entries are collected into a single
+// range that output stream skips over, and the range is copied by the kernel on flush().
+class entry_copier
+{
+public:
+    entry_copier (file_reader& source, std::ostream& out, const tstring& output);
+    ~entry_copier ();
+
+    // Returns: offset of the entry SEQ data within output.
+    uint32_t copy (unsigned seq);
+    void flush ();
+
+private:
+    void transfer (unsigned seq);
+
+    file_reader&            m_source;
+    std::ostream&           m_out;
+    // (offset, size) of the source entries mapped to their output offsets
+    std::map<std::pair<uint32_t, size_t>, uint32_t>
+                            m_copied;
+#ifdef __linux__
+    int                     m_fd;
+    std::vector<unsigned>   m_run;          // adjacent entries waiting to be copied
+    uint64_t                m_src_offset;
+    uint64_t                m_dest_offset;
+    uint64_t                m_size;
+#endif
+
+    entry_copier (const entry_copier&);     // not defined
+    entry_copier& operator= (const entry_copier&);
+};
+
+uint32_t entry_copier::
+copy (unsigned seq)
+{
+    auto key = std::make_pair (m_source.entry_offset (seq), m_source.entry_size (seq));
+    auto it = m_copied.find (key);
+    if (it != m_copied.end())
+        return it->second;
+    uint32_t offset = static_cast<uint32_t> (m_out.tellp());
+    transfer (seq);
+    m_copied[key] = offset;
+    return offset;
+}
+
+#ifdef __linux__
+
+entry_copier::
+entry_copier (file_reader& source, std::ostream& out, const tstring& output)
+    : m_source (source), m_out (out), m_fd (::open (output.c_str(), O_WRONLY))
+    , m_src_offset (0), m_dest_offset (0), m_size (0)
+{
+}
+
+entry_copier::
+~entry_copier ()
+{
+    if (-1 != m_fd)
+        ::close (m_fd);
+}
+
+void entry_copier::
+transfer (unsigned seq)
+{
+    if (-1 == m_fd)
+    {
+        m_source.copy_to (seq, m_out);
+        return;
+    }
+    uint64_t offset = m_source.entry_offset (seq);
+    uint64_t dest_offset = m_out.tellp();
+    if (!m_run.empty() && (offset != m_src_offset + m_size
+                           || dest_offset != m_dest_offset + m_size))
+        flush();
+    if (m_run.empty())
+    {
+        m_src_offset = offset;
+        m_dest_offset = dest_offset;
+        m_size = 0;
+    }
+    size_t size = m_source.entry_size (seq);
+    m_run.push_back (seq);
+    m_size += size;
+    m_out.seekp (size, std::ios::cur);
+}
+
+void entry_copier::
+flush ()
+{
+    if (m_run.empty())
+        return;
+    size_t copied = m_source.copy_range (m_src_offset, m_size, m_fd, m_dest_offset);
+    if (copied < m_size)
+    {
+        // write the rest from the mapped archive
+        std::streamoff pos = m_out.tellp();
+        for (auto it = m_run.begin(); it != m_run.end(); ++it)
+        {
+            uint64_t start = m_source.entry_offset (*it) - m_src_offset;
+            size_t size = m_source.entry_size (*it);
+            if (start + size <= copied)
+                continue;
+            size_t skip = copied > start ? copied - start : 0;
+            archive_span view = m_source.span (*it);
+            m_out.seekp (m_dest_offset + start + skip);
+            m_out.write (view.data() + skip, size - skip);
+        }
+        m_out.seekp (pos);
+    }
+    m_run.clear();
+}
+
+#else
+
+entry_copier::
+entry_copier (file_reader& source, std::ostream& out, const tstring&)
+    : m_source (source), m_out (out)
+{
+}
+
+entry_copier::
+~entry_copier ()
+{
+}
+
+void entry_copier::
+transfer (unsigned seq)
+{
+    m_source.copy_to (seq, m_out);
+}
+
+void entry_copier::
+flush ()
+{
+}
+
+#endif
+
+} // anonymous namespace
+
+bool
+create_from_scratch (const tstring& output, const file_map& input_map, task_progress& progress,
+                     const pack_options& options, entry_cache* cache)
+{
+    const size_t count = input_map.size();
+    assert (count && "No input files for archive");
+    progress.set_max_range (count);
+
+    file_reader::content_type content (count);
+    std::vector<const file_info*> files;
+    files.reserve (count);
+    for (auto it = input_map.begin(); it != input_map.end(); ++it)
+    {
+        content[files.size()].id = it->first;
+        files.push_back (&it->second);
+    }
+    std::ofstream out (output, std::ios::out|std::ios::binary|std::ios::trunc);
+    if (!out)
+        throw sys::file_error (output);
+
+    uint32_t data_offset = count * 16 + 16;
+    out.seekp (data_offset, std::ios::end);
+    std::unique_ptr<blob_table> blobs (options.dedup ? new blob_table (output) : 0);
+    bool success = pack_entries (content, files, options, cache,
+                                 [&] (unsigned index, pack_job& job) -> bool
+    {
+        if (!progress.next (job.file->name))
+            return false;
+        content[index].offset = out.tellp();
+        commit_job (job, content[index], out, cache, blobs.get());
+        return true;
+    });
+    if (!success)
+        return false;
+    out.seekp (0, std::ios::beg);
+    write_ami_header (content, out);
+    if (!out.flush())
+        throw sys::file_error (output);
+    TCLOG << count << _T(" entries written");
+    if (blobs && blobs->saved())
+        TCLOG << _T(", ") << blobs->saved() << _T(" bytes saved by sharing identical entries");
+    TCLOG << _T(".\n");
+    return true;
+}
+
+bool
+create_from_source (const tstring& input, const tstring& output, const file_map& input_map,
+                    task_progress& progress, const pack_options& options, entry_cache* cache)
+{
+    xami::file_reader ami_file (input.c_str());
+    xami::file_reader::content_type content;
+    ami_file.read_content (content);
+    if (content.empty())
+    {
+        TCLOG << input << _T(": archive table of contents is empty.\n");
+        return false;
+    }
+    progress.set_max_range (ami_file.count());
+
+    std::vector<const file_info*> files;
+    files.reserve (content.size());
+    unsigned update_count = 0;
+    for (auto it = content.begin(); it != content.end(); ++it)
+    {
+        auto replacement = input_map.find (it->id);
+        if (replacement != input_map.end())
+        {
+            files.push_back (&replacement->second);
+            ++update_count;
+        }
+        else
+            files.push_back (0);
+    }
+    std::ofstream out (output, std::ios::out|std::ios::binary|std::ios::trunc);
+    if (!out)
+        throw sys::file_error (output);
+
+    uint32_t data_offset = ami_file.count() * 16 + 16;
+    out.seekp (data_offset, std::ios::end);
+    entry_copier copier (ami_file, out, output);
+    std::unique_ptr<blob_table> blobs (options.dedup ? new blob_table (output) : 0);
+    bool success = pack_entries (content, files, options, cache,
+                                 [&] (unsigned index, pack_job& job) -> bool
+    {
+        entry& ent = content[index];
+        if (job.file)
+        {
+            if (!progress.next (job.file->name))
+                return false;
+            ent.offset = out.tellp();
+            commit_job (job, ent, out, cache, blobs.get());
+        }
+        else
+        {
+            if (!progress.next (converter::format_filename (ent.id, _T("dat"))))
+                return false;
+            ent.offset = copier.copy (index);
+        }
+        return true;
+    });
+    if (!success)
+        return false;
+    copier.flush();
+    out.seekp (0, std::ios::beg);
+    write_ami_header (content, out);
+    if (!out.flush())
+        throw sys::file_error (output);
+    TCLOG << content.size() << _T(" entries written, ") << update_count << _T(" updated");
+    if (blobs && blobs->saved())
+        TCLOG << _T(", ") << blobs->saved() << _T(" bytes saved by sharing identical entries");
+    TCLOG << _T(".\n");
+    return true;
+}
+
+xami::file_type
+get_file_type_from_ext (const tstring& ext)
+{
+    // extension is already matched by regexp,
+    // so decide file type by the first symbol only.
+    switch (ext[0])
+    {
+    case _T('P'): case _T('p'): return xami::file_png;
+    case _T('G'): case _T('g'): return xami::file_grp;
+    case _T('Z'): case _T('z'): return xami::file_zgrp;
+    case _T('M'): case _T('m'): return xami::file_mlt;
+    case _T('T'): case _T('t'): return xami::file_txt;
+    default:                    return xami::file_raw;
+    }
+}
+
+// put file NAME of SIZE bytes last modified at TIME into FILE_TABLE, if its name looks like
+// archive entry.
+static void
+add_file (file_map& file_table, const TCHAR* name, uint64_t size, uint64_t time)
+{
+    static tregex name_re (_T("^(.+)\\.(png|mlt|scr|txt|grp|zgrp)$"),
+                           tregex::ECMAScript|tregex::icase);
+    ext::tcmatch match;
+    if (!regex_match (name, match, name_re))
+        return;
+    xami::file_type ftype = get_file_type_from_ext (match[2]);
+    unsigned id = 0;
+    std::shared_ptr<std::vector<char>> contents;
+    if (file_txt == ftype && size > 0 && size <= 0xffffffffu)
+    {
+        // identifier is found in the script header, whole script is kept for the
+        // compiler, so that it's not read twice.
+        std::ifstream in (name, std::ios::in|std::ios::binary);
+        contents = std::make_shared<std::vector<char>> (size);
+        if (!in.read (contents->data(), contents->size()))
+            return;
+        id = scr_compiler::get_id_from_data (contents->data(), contents->size());
+    }
+    else if (file_txt == ftype)
+        id = scr_compiler::get_id_from_file (name);
+    else
+        id = _tcstoul (name, 0, 16);
+    if (!id)
+        return;
+
+    if (size > 0xffffffffu)
+    {
+        TCLOG << name << _T(": file too long.\n");
+        return;
+    }
+    if (!size)
+    {
+        TCLOG << name << _T(": file is empty.\n");
+        return;
+    }
+    auto it = file_table.find (id);
+    if (it != file_table.end() && time <= it->second.time)
+        return;
+    file_info& info = file_table[id];
+    info = file_info (name, size, ftype);
+    info.time = time;
+    info.contents = std::move (contents);
+}
+
+#ifdef _WIN32
+
+struct base_find_handle
+{
+    static bool close_handle (sys::raw_handle h)
+    {
+        return ::FindClose (h);
+    }
+};
+typedef sys::generic_handle<sys::win_invalid_handle, base_find_handle> find_handle;
+
+void
+build_file_table (file_map& file_table)
+{
+    WIN32_FIND_DATA find_data;
+    find_handle hdir (::FindFirstFile (_T("*"), &find_data));
+    if (!hdir)
+        return;
+    do
+    {
+        if (find_data.dwFileAttributes & (FILE_ATTRIBUTE_HIDDEN|FILE_ATTRIBUTE_SYSTEM|FILE_ATTRIBUTE_DIRECTORY))
+            continue;
+        uint64_t size = uint64_t (find_data.nFileSizeHigh) << 32 | find_data.nFileSizeLow;
+        uint64_t time = uint64_t (find_data.ftLastWriteTime.dwHighDateTime) << 32
+                      | find_data.ftLastWriteTime.dwLowDateTime;
+        add_file (file_table, find_data.cFileName, size, time);
+    }
+    while (::FindNextFile (hdir, &find_data) != 0);
+}
+
+class temporary_file
+{
+    TCHAR temp_name[MAX_PATH];
+
+public:
+    temporary_file (const TCHAR* path, const TCHAR* prefix, UINT id = 0)
+    {
+        if (!::GetTempFileName (path, prefix, id, temp_name))
+        {
+            int err = ::GetLastError();
+            TCLOG << _T("Unable to create temporary file. ") << get_error_text (err);
+            throw sys::file_error (err, path);
+        }
+    }
+    ~temporary_file () { ::DeleteFile (temp_name); }
+
+    const TCHAR* name () const { return temp_name; }
+};
+
+#else
+
+void
+build_file_table (file_map& file_table)
+{
+    DIR* dir = ::opendir (".");
+    if (!dir)
+        return;
+    while (struct dirent* entry = ::readdir (dir))
+    {
+        // hidden files
+        if ('.' == entry->d_name[0])
+            continue;
+        struct stat st;
+        if (-1 == ::stat (entry->d_name, &st) || !S_ISREG (st.st_mode))
+            continue;
+        file_info info (entry->d_name, st, file_raw);
+        add_file (file_table, entry->d_name, st.st_size, info.time);
+    }
+    ::closedir (dir);
+}
+
+class temporary_file
+{
+    std::string temp_name;
+
+public:
+    temporary_file (const char* path, const char* prefix)
+        : temp_name (std::string (path) + '/' + prefix + "XXXXXX")
+    {
+        int fd = ::mkstemp (&temp_name[0]);
+        if (-1 == fd)
+        {
+            int err = errno;
+            TCLOG << "Unable to create temporary file. " << get_error_text (err);
+            throw sys::file_error (err, path);
+        }
+        // mkstemp creates file accessible by owner only, while it's going to replace the
+        // archive, which is expected to have default permissions.
+        mode_t mask = ::umask (0);
+        ::umask (mask);
+        ::fchmod (fd, 0666 & ~mask);
+        ::close (fd);
+    }
+    ~temporary_file () { ::unlink (temp_name.c_str()); }
+
+    const char* name () const { return temp_name.c_str(); }
+};
+
+#endif
+
+bool
+pack_archive (const tstring& output, const file_map& input_map, const tstring& source,
+              task_progress& progress, const pack_options& options)
+{
+    tstring temp_path (output);
+    size_t name_pos = temp_path.rfind (ext::path_separator);
+    if (tstring::npos != name_pos && 0 != name_pos)
+        temp_path.erase (name_pos, tstring::npos);
+    else
+        temp_path = _T('.');
+    temporary_file tmp (temp_path.c_str(), _T("xami"));
+
+    bool use_cache = options.use_cache;
+    entry_cache cache;
+    if (use_cache && !cache.open (output))
+    {
+        TCLOG << entry_cache::sidecar_name (output) << _T(": unable to create cache.\n");
+        use_cache = false;
+    }
+    entry_cache* cache_ptr = use_cache ? &cache : 0;
+    bool success;
+    if (!source.empty())
+        success = create_from_source (source, tmp.name(), input_map, progress, options, cache_ptr);
+    else
+        success = create_from_scratch (tmp.name(), input_map, progress, options, cache_ptr);
+    if (success && !ext::replace_file (tmp.name(), output.c_str()))
+        throw sys::file_error (output.c_str());
+    if (success && use_cache && !cache.commit())
+        TCLOG << entry_cache::sidecar_name (output) << _T(": unable to write cache.\n");
+    return success;
+}
+
+namespace {
+
+const uint32_t journal_signature = 0x4a494d41; // 'AMIJ'
+const uint32_t journal_version = 1;
+
+tstring
+journal_name (const tstring& archive)
+{
+    return archive + _T(".journal");
+}
+
+// save first TOC_SIZE bytes of ARCHIVE into journal.
+void
+write_journal (const tstring& archive, size_t toc_size)
+{
+    std::vector<char> toc (toc_size);
+    std::ifstream in (archive, std::ios::in|std::ios::binary);
+    if (!in.read (toc.data(), toc.size()))
+        throw sys::file_error (archive);
+    tstring journal = journal_name (archive);
+    std::ofstream out (journal, std::ios::out|std::ios::trunc|std::ios::binary);
+    bin::write32bit (out, journal_signature);
+    bin::write32bit (out, journal_version);
+    bin::write32bit (out, toc.size());
+    out.write (toc.data(), toc.size());
+    if (!out.flush())
+        throw sys::file_error (journal);
+    out.close();
+    // journal has to reach the disk before archive is touched
+    if (!ext::sync_file (journal.c_str()) || !ext::sync_directory_of (journal.c_str()))
+        throw sys::file_error (journal);
+}
+
+// finish update of ARCHIVE, discarding its journal.
+void
+delete_journal (const tstring& archive)
+{
+    if (!ext::sync_file (archive.c_str()))
+        throw sys::file_error (archive);
+    tstring journal = journal_name (archive);
+    ext::delete_file (journal.c_str());
+    ext::sync_directory_of (journal.c_str());
+}
+
+} // anonymous namespace
+
+bool
+recover_archive (const tstring& archive)
+{
+    tstring journal = journal_name (archive);
+    std::ifstream in (journal, std::ios::in|std::ios::binary);
+    if (!in)
+        return false;
+    uint32_t header[3];
+    std::vector<char> toc;
+    bool valid = false;
+    if (in.read (reinterpret_cast<char*> (header), sizeof(header))
+        && bin::little_dword (header[0]) == journal_signature
+        && bin::little_dword (header[1]) == journal_version)
+    {
+        toc.resize (bin::little_dword (header[2]));
+        valid = !toc.empty() && in.read (toc.data(), toc.size());
+    }
+    in.close();
+    // incomplete journal means that archive wasn't modified yet
+    if (valid)
+    {
+        std::fstream io (archive, std::ios::in|std::ios::out|std::ios::binary);
+        if (!io.write (toc.data(), toc.size()) || !io.flush())
+            throw sys::file_error (archive);
+        io.close();
+        TCLOG << archive << _T(": table of contents restored after interrupted update.\n");
+        delete_journal (archive);
+    }
+    else
+        ext::delete_file (journal.c_str());
+    return valid;
+}
+
+bool
+patch_archive (const tstring& archive, const file_map& input_map, task_progress& progress,
+               const pack_options& options)
+{
+    recover_archive (archive);
+    file_reader::content_type content;
+    {
+        file_reader ami_file (archive.c_str());
+        ami_file.read_content (content);
+    }
+    if (content.empty())
+    {
+        TCLOG << archive << _T(": archive table of contents is empty.\n");
+        return false;
+    }
+    std::map<uint32_t, unsigned> entry_map;
+    for (unsigned i = content.size(); i-- > 0; )
+        entry_map[content[i].id] = i;
+
+    std::vector<const file_info*> files (content.size());
+    unsigned missing = 0;
+    for (auto it = input_map.begin(); it != input_map.end(); ++it)
+    {
+        auto entry = entry_map.find (it->first);
+        if (entry != entry_map.end())
+            files[entry->second] = &it->second;
+        else
+        {
+            TCLOG << it->second.name << _T(": there's no such entry in archive.\n");
+            ++missing;
+        }
+    }
+    if (missing)
+    {
+        TCLOG << _T("New entries couldn't be added by patching, create archive instead.\n");
+        return false;
+    }
+    progress.set_max_range (input_map.size());
+
+    // original table of contents is kept in journal until the new one is written, so
+    // that archive could be restored if update is interrupted.  replaced entries are
+    // appended to the end of archive, leaving their old data unused.
+    const size_t toc_size = content.size() * 16 + 16;
+    write_journal (archive, toc_size);
+    std::fstream io (archive, std::ios::in|std::ios::out|std::ios::binary);
+    if (!io)
+        throw sys::file_error (archive);
+    io.seekp (0, std::ios::end);
+    bool success = pack_entries (content, files, options, 0, [&] (unsigned index, pack_job& job) -> bool
+    {
+        if (!job.file)
+            return true;
+        if (!progress.next (job.file->name))
+            return false;
+        std::streamoff offset = io.tellp();
+        if (offset > 0xffffffff)
+            throw std::runtime_error ("Archive is too large.");
+        content[index].offset = static_cast<uint32_t> (offset);
+        commit_job (job, content[index], io, 0, 0);
+        return true;
+    });
+    if (success)
+    {
+        // data shared by deduplicated entries is counted once
+        std::map<uint32_t, uint64_t> blobs;
+        for (auto it = content.begin(); it != content.end(); ++it)
+        {
+            uint64_t& size = blobs[it->offset];
+            size = std::max<uint64_t> (size, it->packed_size ? it->packed_size : it->unpacked_size);
+        }
+        uint64_t used = toc_size;
+        for (auto it = blobs.begin(); it != blobs.end(); ++it)
+            used += it->second;
+        uint64_t total = io.tellp();
+        // appended data has to reach the disk before table of contents refers to it
+        if (!io.flush() || !ext::sync_file (archive.c_str()))
+            throw sys::file_error (archive);
+        io.seekp (0, std::ios::beg);
+        write_ami_header (content, io);
+        if (!io.flush())
+            throw sys::file_error (archive);
+        TCLOG << input_map.size() << _T(" entries updated");
+        if (total > used)
+            TCLOG << _T(", ") << total - used << _T(" bytes of archive are unused");
+        TCLOG << _T(".\n");
+    }
+    io.close();
+    delete_journal (archive);
+    return success;
+}
+
+bool
+compact_archive (const tstring& archive, task_progress& progress, unsigned workers)
+{
+    recover_archive (archive);
+    pack_options options;
+    options.workers = workers;
+    return pack_archive (archive, file_map(), archive, progress, options);
+}
+
+tstring
+zgrp_name (const tstring& image)
+{
+    size_t dot = image.find_last_of (_T("./\\"));
+    if (tstring::npos == dot || _T('.') != image[dot])
+        dot = image.size();
+    return image.substr (0, dot) + _T(".zgrp");
+}
+
+namespace {
+
+struct precompile_job
+{
+    const file_info*    file;
+    ext::tostringstream log;
+    std::exception_ptr  error;
+    bool                done;
+
+    precompile_job () : file (0), done (false) { }
+};
+
+// convert PNG image FILE into ZGRP file OUTPUT.  incomplete file is removed on failure.
+void
+write_zgrp_image (const file_info& file, const tstring& output, deflate_params params,
+                  ext::tostream& log)
+{
+    std::ofstream out (output, std::ios::out|std::ios::trunc|std::ios::binary);
+    if (!out)
+        throw sys::file_error (output);
+    try
+    {
+        // unpacked size is known after conversion only
+        bin::write32bit (out, 0);
+        size_t packed_size;
+        size_t unpacked_size = convert_png (file.name, out, packed_size, params, log);
+        out.seekp (0);
+        bin::write32bit (out, unpacked_size);
+        if (!out.flush())
+            throw sys::file_error (output);
+    }
+    catch (...)
+    {
+        out.close();
+        ext::delete_file (output.c_str());
+        throw;
+    }
+}
+
+} // anonymous namespace
+
+bool
+precompile_images (const std::vector<file_info>& images, task_progress& progress,
+                   const pack_options& options)
+{
+    const size_t total = images.size();
+    std::vector<std::unique_ptr<precompile_job>> jobs (total);
+    for (size_t i = 0; i < total; ++i)
+    {
+        jobs[i].reset (new precompile_job);
+        jobs[i]->file = &images[i];
+    }
+    deflate_params params = get_compression_params (options.compression);
+    unsigned workers = options.workers;
+    if (!workers)
+        workers = std::thread::hardware_concurrency();
+
+    // images are converted by the workers in any order, while calling thread reports them
+    // in the order of IMAGES.
+    std::atomic<size_t> next_job (0);
+    std::atomic<bool> cancelled (false);
+    std::mutex done_lock;
+    std::condition_variable done_cond;
+    auto worker = [&] ()
+    {
+        for (size_t i = next_job++; i < total && !cancelled; i = next_job++)
+        {
+            precompile_job& job = *jobs[i];
+            try
+            {
+                write_zgrp_image (*job.file, zgrp_name (job.file->name), params, job.log);
+            }
+            catch (...)
+            {
+                job.error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> guard (done_lock);
+            job.done = true;
+            done_cond.notify_all();
+        }
+    };
+    struct pipeline_guard
+    {
+        std::atomic<bool>&  cancelled;
+        thread_group        threads;
+
+        explicit pipeline_guard (std::atomic<bool>& flag) : cancelled (flag) { }
+        ~pipeline_guard ()
+        {
+            cancelled = true;
+            threads.join();
+        }
+    } pipeline (cancelled);
+    pipeline.threads.create (std::max (1u, workers), worker);
+
+    progress.set_max_range (total);
+    for (size_t i = 0; i < total; ++i)
+    {
+        precompile_job& job = *jobs[i];
+        {
+            std::unique_lock<std::mutex> guard (done_lock);
+            done_cond.wait (guard, [&] { return job.done; });
+        }
+        TCLOG << job.log.str();
+        if (job.error)
+            std::rethrow_exception (job.error);
+        if (!progress.next (job.file->name))
+            return false;
+    }
+    TCLOG << total << _T(" images precompiled.\n");
+    return true;
+}
+
+} // namespace xami
@@ -0,0 +1,112 @@
+// -*- C++ -*-
+//! \file       ami-create.hpp
+//! \date       Sat Oct 17 17:10:26 2026
+//! \brief      AMI archive creation.
+//
+// Copyright (C) 2014 morkt and the MuvLuvRu project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+
+#ifndef AMI_CREATE_HPP
+#define AMI_CREATE_HPP
+
+#include <map>
+#include "ami-archive.hpp"
+#include "task-progress.hpp"
+
+namespace xami {
+
+class entry_cache;
+
+struct pack_options
+{
+    unsigned    workers;        // number of compiling threads, 0 means number of CPU cores
+    bool        use_cache;      // keep compiled entries in the file alongside archive
+    bool        dedup;          // store identical entries once
+    compression_preset compression;
+
+    pack_options () : workers (1), use_cache (false), dedup (false)
+                    , compression (compression_max) { }
+};
+
+// files to be put into archive, keyed by entry identifiers.
+typedef std::map<unsigned, file_info> file_map;
+
+// collect files within current directory that could be put into archive.  when there're
+// several files for the same entry, the most recently modified one is chosen.
+void build_file_table (file_map& file_table);
+
+// write archive OUTPUT consisting of the files from INPUT_MAP.  archive layout doesn't
+// depend on the number of workers.  entries found in CACHE aren't compiled again, and
+// every written entry is put into it.
+// Returns: FALSE if operation was aborted.
+bool create_from_scratch (const tstring& output, const file_map& input_map,
+                          task_progress& progress, const pack_options& options = pack_options(),
+                          entry_cache* cache = 0);
+
+// write archive OUTPUT with the contents of archive INPUT, replacing its entries with the
+// files from INPUT_MAP.  entries copied from INPUT are written by the calling thread,
+// and aren't put into CACHE or deduplicated, but entries that share data in INPUT share
+// it in OUTPUT as well.
+// Returns: FALSE if operation was aborted.
+bool create_from_source (const tstring& input, const tstring& output, const file_map& input_map,
+                         task_progress& progress, const pack_options& options = pack_options(),
+                         entry_cache* cache = 0);
+
+// create archive OUTPUT from INPUT_MAP and, if SOURCE is not empty, entries of archive
+// SOURCE missing in INPUT_MAP.  archive is written into temporary file first, and moved
+// into OUTPUT on success.  with OPTIONS.use_cache, compiled entries are kept in the cache
+// file alongside OUTPUT and reused by subsequent calls.
+// Returns: FALSE if operation was aborted.
+bool pack_archive (const tstring& output, const file_map& input_map, const tstring& source,
+                   task_progress& progress, const pack_options& options = pack_options());
+
+// replace entries of ARCHIVE with the files from INPUT_MAP in place.  new data is
+// appended to the end of archive and table of contents is rewritten, while its original
+// copy is kept in the journal file until update is complete.  journal and appended data
+// are synchronized to disk before table of contents is rewritten, so that archive could
+// be restored after power loss as well.  space occupied by replaced entries is reclaimed
+// by compact_archive.  files for the entries missing in ARCHIVE aren't allowed.  OPTIONS.use_cache and OPTIONS.dedup are ignored.
+// Returns: FALSE if operation was aborted or INPUT_MAP has new entries.
+bool patch_archive (const tstring& archive, const file_map& input_map, task_progress& progress,
+                    const pack_options& options = pack_options());
+
+// rewrite ARCHIVE without space left unused by patch_archive.
+// Returns: FALSE if operation was aborted.
+bool compact_archive (const tstring& archive, task_progress& progress, unsigned workers = 1);
+
+// name of the ZGRP file precompiled from the IMAGE file.
+tstring zgrp_name (const tstring& image);
+
+// convert PNG files listed in IMAGES into compressed ZGRP files next to them, using
+// OPTIONS.workers threads and OPTIONS.compression preset.  since precompiled files are
+// newer than their sources, build_file_table picks them up instead, and they're copied
+// into archive without being recompressed.
+// Returns: FALSE if operation was aborted.
+bool precompile_images (const std::vector<file_info>& images, task_progress& progress,
+                        const pack_options& options = pack_options());
+
+// restore table of contents of ARCHIVE if its update by patch_archive was interrupted.
+// Returns: TRUE if archive was restored.
+bool recover_archive (const tstring& archive);
+
+} // namespace xami
+
+#endif /* AMI_CREATE_HPP */
@@ -24,8 +24,27 @@
 // IN THE SOFTWARE.
 //
 
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include "work-queue.hpp"
+
 namespace xami {
 
+template<class Writer> bool extractor<Writer>::
+is_filtered () const
+{
+    return !m_writer.accepts (entry_raw) || !m_writer.accepts (entry_script)
+        || !m_writer.accepts (entry_image);
+}
+
+template<class Writer> bool extractor<Writer>::
+skip_entry (unsigned seq, entry_type& type) const
+{
+    type = classify (seq);
+    return !m_writer.accepts (type);
+}
+
 template<class Writer> bool extractor<Writer>::
 extract_entry (unsigned seq)
 {
@@ -33,17 +52,24 @@ extract_entry (unsigned seq)
     const uint32_t* entry = header() + seq * 4;
 
     uint32_t id = bin::little_dword (entry[0]);
-    uint32_t offset = bin::little_dword (entry[1]);
+    entry_type type = entry_raw;
+    if (is_filtered() && skip_entry (seq, type))
+        return m_writer.skip (id, type);
+
     size_t unpacked_size = bin::little_dword (entry[2]);
     size_t packed_size = bin::little_dword (entry[3]);
-    size_t view_size = packed_size ? packed_size : unpacked_size;
-    sys::mapping::const_view<char> data (m_in, offset, view_size);
+    archive_span data = span (seq);
+    size_t view_size = data.size();
+    m_bytes_read += view_size;
     bool result = true;
-    if (packed_size)
+    if (packed_size && !is_filtered())
+        type = classify (seq);
+    if (packed_size && m_writer.keeps_packed (type))
+        result = m_writer.write_packed (id, type, data.begin(), view_size, unpacked_size);
+    else if (packed_size)
     {
         m_out_data.clear();
-        m_out_data.reserve (unpacked_size);
-        memory_inflate (data.begin(), view_size, m_out_data);
+        memory_inflate (data.begin(), view_size, m_out_data, unpacked_size);
 
         if (m_out_data.size() > 12 && 0 == std::memcmp (&m_out_data[0], "GRP", 4))
             result = m_writer.write_image (id, &m_out_data[0], m_out_data.size());
@@ -58,28 +84,356 @@ extract_entry (unsigned seq)
     return result;
 }
 
+template<class Writer> size_t extractor<Writer>::
+entry_cost (unsigned seq, entry_type type) const
+{
+    // mapped view plus inflated data.  conversion results are usually smaller than
+    // inflated data and are not accounted for.
+    const uint32_t* entry = header() + seq * 4;
+    size_t unpacked_size = bin::little_dword (entry[2]);
+    size_t packed_size = bin::little_dword (entry[3]);
+    if (!packed_size)
+        return unpacked_size;
+    return is_kept_packed (type) ? packed_size : packed_size + unpacked_size;
+}
+
+template<class Writer> void extractor<Writer>::
+read_job (extract_job& job) const
+{
+    job.id = entry_id (job.seq);
+    job.view = span (job.seq);
+    job.data = job.view.data();
+    job.size = job.view.size();
+    touch_pages (job.data, job.size);
+}
+
+template<class Writer> void extractor<Writer>::
+inflate_job (extract_job& job) const
+{
+    const uint32_t* entry = header() + job.seq * 4;
+    size_t unpacked_size = bin::little_dword (entry[2]);
+    size_t packed_size = bin::little_dword (entry[3]);
+    if (packed_size && is_kept_packed (job.type))
+        job.is_packed = true;
+    else if (packed_size)
+    {
+        memory_inflate (job.data, job.size, job.unpacked, unpacked_size);
+        job.view = archive_span();
+        job.data = job.unpacked.data();
+        job.size = job.unpacked.size();
+        if (job.size > 12 && 0 == std::memcmp (job.data, "GRP", 4))
+            job.type = entry_image;
+        else
+            job.type = entry_raw;
+    }
+    else if (job.size > 12 && 0 == std::memcmp (job.data, "SCR", 4))
+        job.type = entry_script;
+    else
+        job.type = entry_raw;
+}
+
+template<class Writer> void extractor<Writer>::
+encode_job (extract_job& job) const
+{
+    if (entry_image == job.type)
+        job.is_converted = m_writer.convert_image (job.id, job.data, job.size, job.converted);
+    else if (entry_script == job.type)
+        job.is_converted = m_writer.convert_script (job.id, job.data, job.size, job.converted);
+}
+
 template<class Writer> bool extractor<Writer>::
-extract (uint32_t id)
+commit_job (extract_job& job)
 {
-    const uint32_t* entry = m_header.begin();
-    for (unsigned i = 0; i < m_count; ++i)
+    if (job.error)
+        std::rethrow_exception (job.error);
+    if (job.is_skipped)
+        return m_writer.skip (job.id, job.type);
+    if (job.is_converted)
+        return m_writer.write_converted (job.id, job.type, job.converted.data(), job.converted.size());
+    if (job.is_packed)
+        return m_writer.write_packed (job.id, job.type, job.data, job.size,
+                                      bin::little_dword (header()[job.seq*4+2]));
+    switch (job.type)
     {
-        uint32_t entry_id = bin::little_dword (entry[0]);
-        if (entry_id == id)
-            return extract_entry (i);
-        entry += 4;
+    case entry_image:   return m_writer.write_image (job.id, job.data, job.size);
+    case entry_script:  return m_writer.write_script (job.id, job.data, job.size);
+    default:            return m_writer.write_raw (job.id, job.data, job.size);
     }
-    return false;
+}
+
+template<class Writer> void extractor<Writer>::
+set_workers (unsigned count)
+{
+    if (!count)
+        count = std::thread::hardware_concurrency();
+    m_workers = count ? count : 1;
+}
+
+template<class Writer> void extractor<Writer>::
+build_schedule (std::vector<unsigned>& order) const
+{
+    order.resize (this->count());
+    for (unsigned i = 0; i < order.size(); ++i)
+        order[i] = i;
+    if (schedule_offset == m_schedule)
+        std::stable_sort (order.begin(), order.end(), [this] (unsigned lhs, unsigned rhs) {
+            return entry_offset (lhs) < entry_offset (rhs);
+        });
 }
 
 template<class Writer> unsigned extractor<Writer>::
-extract ()
+readahead (const std::vector<unsigned>& order, unsigned pos) const
 {
+    // hint entries starting at POS until readahead_size bytes are covered.  entries
+    // sorted by offset are hinted as a single range.
+    // Returns: position of the first entry not covered by hint.
+    size_t total = 0;
+    size_t range_start = 0, range_end = 0;
+    for (; pos < order.size() && total < readahead_size; ++pos)
+    {
+        size_t offset = entry_offset (order[pos]);
+        size_t size = entry_size (order[pos]);
+        if (schedule_offset != m_schedule)
+            advise (offset, size);
+        else if (!total)
+            range_start = offset;
+        range_end = offset + size;
+        total += size;
+    }
+    if (schedule_offset == m_schedule && range_end > range_start)
+        advise (range_start, range_end - range_start);
+    return pos;
+}
+
+template<class Writer> unsigned extractor<Writer>::
+extract_serial (const std::vector<unsigned>& order)
+{
+    unsigned hint_end = readahead (order, 0);
+    unsigned hint_next = 0;
+    unsigned i;
+    for (i = 0; i < order.size(); ++i)
+    {
+        if (i >= hint_next && hint_end < order.size())
+        {
+            hint_next = hint_end;
+            hint_end = readahead (order, hint_end);
+        }
+        if (!extract_entry (order[i]))
+            break;
+    }
+    return i;
+}
+
+template<class Writer> unsigned extractor<Writer>::
+extract_parallel (const std::vector<unsigned>& order)
+{
+    // entries flow through the stages
+    //   reader -> inflate queue -> inflaters -> encode queue -> encoders -> writer,
+    // raw entries skip the encode stage.  reader admits entries in the ORDER within
+    // memory budget, hinting the system about data it's going to read next.  writer
+    // (the calling thread) commits entries in the same order.
+    typedef std::unique_ptr<extract_job> job_ptr;
+
+    const unsigned total = order.size();
+    bounded_queue<job_ptr> inflate_queue (m_queue_depth);
+    bounded_queue<job_ptr> encode_queue (m_queue_depth);
+    memory_budget budget (m_memory_budget);
+
+    std::mutex done_lock;
+    std::condition_variable done_cond;
+    std::map<unsigned, job_ptr> done;
+    unsigned inflaters_left = m_workers;
+    const bool filtered = is_filtered();
+
+    auto complete = [&] (job_ptr job)
+    {
+        std::lock_guard<std::mutex> guard (done_lock);
+        unsigned pos = job->pos;
+        done[pos] = std::move (job);
+        done_cond.notify_all();
+    };
+    auto reader = [&] ()
+    {
+        unsigned hint_end = readahead (order, 0);
+        unsigned hint_next = 0;
+        for (unsigned pos = 0; pos < total; ++pos)
+        {
+            if (pos >= hint_next && hint_end < total)
+            {
+                hint_next = hint_end;
+                hint_end = readahead (order, hint_end);
+            }
+            job_ptr job (new extract_job);
+            job->seq = order[pos];
+            job->pos = pos;
+            try
+            {
+                if (filtered && skip_entry (job->seq, job->type))
+                {
+                    job->id = entry_id (job->seq);
+                    job->is_skipped = true;
+                }
+                else
+                {
+                    if (!filtered)
+                        job->type = classify (job->seq);
+                    job->cost = entry_cost (job->seq, job->type);
+                }
+            }
+            catch (...)
+            {
+                job->error = std::current_exception();
+            }
+            if (!budget.acquire (job->cost))
+                break;
+            if (!job->is_skipped && !job->error)
+            {
+                try
+                {
+                    read_job (*job);
+                }
+                catch (...)
+                {
+                    job->error = std::current_exception();
+                }
+            }
+            if (job->error || job->is_skipped)
+                complete (std::move (job));
+            else if (!inflate_queue.push (std::move (job)))
+                break;
+        }
+        inflate_queue.close();
+    };
+    auto inflater = [&] ()
+    {
+        job_ptr job;
+        while (inflate_queue.pop (job))
+        {
+            try
+            {
+                inflate_job (*job);
+            }
+            catch (...)
+            {
+                job->error = std::current_exception();
+            }
+            if (!job->error && entry_raw != job->type)
+            {
+                if (!encode_queue.push (std::move (job)))
+                    break;
+            }
+            else
+                complete (std::move (job));
+        }
+        std::lock_guard<std::mutex> guard (done_lock);
+        if (!--inflaters_left)
+            encode_queue.close();
+    };
+    auto encoder = [&] ()
+    {
+        job_ptr job;
+        while (encode_queue.pop (job))
+        {
+            try
+            {
+                encode_job (*job);
+            }
+            catch (...)
+            {
+                job->error = std::current_exception();
+            }
+            complete (std::move (job));
+        }
+    };
+
+    struct pipeline_guard
+    {
+        bounded_queue<job_ptr>& q1;
+        bounded_queue<job_ptr>& q2;
+        memory_budget&          budget;
+        thread_group            threads;
+
+        pipeline_guard (bounded_queue<job_ptr>& a, bounded_queue<job_ptr>& b, memory_budget& m)
+            : q1 (a), q2 (b), budget (m) { }
+        ~pipeline_guard ()
+        {
+            q1.cancel();
+            q2.cancel();
+            budget.cancel();
+            threads.join();
+        }
+    } pipeline (inflate_queue, encode_queue, budget);
+
+    pipeline.threads.create (1, reader);
+    pipeline.threads.create (m_workers, inflater);
+    pipeline.threads.create (m_workers, encoder);
+
     unsigned i;
-    for (i = 0; i < this->count(); ++i)
-        if (!extract_entry (i))
+    for (i = 0; i < total; ++i)
+    {
+        job_ptr job;
+        {
+            std::unique_lock<std::mutex> guard (done_lock);
+            done_cond.wait (guard, [&] { return done.count (i) != 0; });
+            job = std::move (done[i]);
+            done.erase (i);
+        }
+        bool result = commit_job (*job);
+        budget.release (job->cost);
+        if (!result)
             break;
+        // entries skipped by the writer weren't read
+        if (!job->is_skipped)
+            m_bytes_read += entry_size (job->seq);
+    }
     return i;
 }
 
+template<class Writer> bool extractor<Writer>::
+extract (uint32_t id)
+{
+    unsigned seq;
+    if (!find (id, seq))
+        return false;
+    return extract_entry (seq);
+}
+
+template<class Writer> unsigned extractor<Writer>::
+extract (const std::vector<uint32_t>& ids)
+{
+    std::vector<std::pair<uint32_t, unsigned>> order;
+    order.reserve (ids.size());
+    for (auto it = ids.begin(); it != ids.end(); ++it)
+    {
+        unsigned seq;
+        if (find (*it, seq))
+            order.push_back (std::make_pair (entry_offset (seq), seq));
+    }
+    std::sort (order.begin(), order.end());
+    order.erase (std::unique (order.begin(), order.end()), order.end());
+    unsigned count = 0;
+    for (auto it = order.begin(); it != order.end(); ++it, ++count)
+        if (!extract_entry (it->second))
+            break;
+    return count;
+}
+
+template<class Writer> unsigned extractor<Writer>::
+extract ()
+{
+    auto start = std::chrono::steady_clock::now();
+    m_bytes_read = 0;
+    std::vector<unsigned> order;
+    build_schedule (order);
+    if (schedule_offset == m_schedule)
+        advise_sequential();
+    unsigned count;
+    if (m_workers > 1 && order.size() > 1)
+        count = extract_parallel (order);
+    else
+        count = extract_serial (order);
+    m_elapsed = std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+    return count;
+}
+
 } // namespace xami
@@ -0,0 +1,185 @@
+// -*- C++ -*-
+//! \file       ami-index.cc
+//! \date       Sat Oct 17 15:03:10 2026
+//! \brief      AMI archive sidecar index implementation.
+//
+// Copyright (C) 2014 morkt and the MuvLuvRu project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+
+#include "ami-index.hpp"
+#include "xami-util.hpp"
+#include "binio.h"
+#include <fstream>
+#include <cstring>
+#include <zlib.h>
+
+namespace xami {
+
+namespace {
+
+const uint32_t index_signature = 0x58494d41; // 'AMIX'
+const uint32_t index_version = 1;
+const size_t index_header_size = 7;     // in dwords
+const size_t index_record_size = 6;
+
+} // anonymous namespace
+
+uint32_t archive_index::
+toc_crc (const file_reader& archive)
+{
+    return crc32 (0, reinterpret_cast<const Bytef*> (archive.header()), archive.count() * 16);
+}
+
+void archive_index::
+build (const file_reader& archive, const file_info& source)
+{
+    m_size = source.size;
+    m_time = source.time;
+    m_crc = toc_crc (archive);
+    m_entries.assign (archive.count(), entry_info());
+    std::vector<char> unpacked;
+    for (unsigned seq = 0; seq < archive.count(); ++seq)
+    {
+        const uint32_t* entry = archive.header() + seq * 4;
+        size_t unpacked_size = bin::little_dword (entry[2]);
+        size_t packed_size = bin::little_dword (entry[3]);
+        entry_info& info = m_entries[seq];
+        info.id = bin::little_dword (entry[0]);
+
+        archive_span view = archive.span (seq);
+        const char* data = view.data();
+        size_t size = view.size();
+        if (packed_size)
+        {
+            unpacked.clear();
+            memory_inflate (data, size, unpacked, unpacked_size);
+            data = unpacked.data();
+            size = unpacked.size();
+        }
+        info.crc = crc32 (0, reinterpret_cast<const Bytef*> (data), size);
+        if (size <= GRP_HEADER_SIZE)
+            continue;
+        if (packed_size && 0 == std::memcmp (data, "GRP", 4))
+        {
+            const uint8_t* grp_data = reinterpret_cast<const uint8_t*> (data);
+            info.type   = entry_image;
+            info.width  = get_grp_width (grp_data);
+            info.height = get_grp_height (grp_data);
+            info.ref_x  = get_grp_ref_x (grp_data);
+            info.ref_y  = get_grp_ref_y (grp_data);
+        }
+        else if (!packed_size && 0 == std::memcmp (data, "SCR", 4))
+        {
+            info.type = entry_script;
+            if (check_script (data, size))
+                info.lines = bin::little_dword (reinterpret_cast<const uint32_t*> (data)[2]);
+        }
+    }
+}
+
+bool archive_index::
+load (const tstring& filename, const file_reader& archive, const file_info& source)
+{
+    std::ifstream in (filename, std::ios::in|std::ios::binary);
+    if (!in)
+        return false;
+    uint32_t header[index_header_size];
+    if (!in.read (reinterpret_cast<char*> (header), sizeof(header)))
+        return false;
+    if (bin::little_dword (header[0]) != index_signature
+        || bin::little_dword (header[1]) != index_version
+        || bin::little_dword (header[2]) != source.size
+        || bin::little_dword (header[3]) != uint32_t (source.time)
+        || bin::little_dword (header[4]) != uint32_t (source.time >> 32)
+        || bin::little_dword (header[5]) != toc_crc (archive)
+        || bin::little_dword (header[6]) != archive.count())
+        return false;
+
+    std::vector<uint32_t> records (archive.count() * index_record_size);
+    if (!records.empty()
+        && !in.read (reinterpret_cast<char*> (&records[0]), records.size() * sizeof(uint32_t)))
+        return false;
+
+    std::vector<entry_info> entries (archive.count());
+    auto record = records.begin();
+    for (auto it = entries.begin(); it != entries.end(); ++it, record += index_record_size)
+    {
+        uint32_t dims = bin::little_dword (record[4]);
+        uint32_t refs = bin::little_dword (record[5]);
+        it->id      = bin::little_dword (record[0]);
+        it->crc     = bin::little_dword (record[1]);
+        it->type    = static_cast<entry_type> (bin::little_dword (record[2]));
+        it->lines   = bin::little_dword (record[3]);
+        it->width   = dims & 0xffff;
+        it->height  = dims >> 16;
+        it->ref_x   = static_cast<int16_t> (refs & 0xffff);
+        it->ref_y   = static_cast<int16_t> (refs >> 16);
+        if (it->type > entry_image)
+            return false;
+    }
+    m_size = source.size;
+    m_time = source.time;
+    m_crc = bin::little_dword (header[5]);
+    m_entries.swap (entries);
+    return true;
+}
+
+bool archive_index::
+save (const tstring& filename) const
+{
+    std::ofstream out (filename, std::ios::out|std::ios::trunc|std::ios::binary);
+    if (!out)
+        return false;
+    bin::write32bit (out, index_signature);
+    bin::write32bit (out, index_version);
+    bin::write32bit (out, m_size);
+    bin::write32bit (out, uint32_t (m_time));
+    bin::write32bit (out, uint32_t (m_time >> 32));
+    bin::write32bit (out, m_crc);
+    bin::write32bit (out, m_entries.size());
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        bin::write32bit (out, it->id);
+        bin::write32bit (out, it->crc);
+        bin::write32bit (out, static_cast<uint32_t> (it->type));
+        bin::write32bit (out, it->lines);
+        bin::write32bit (out, uint32_t (it->width) | uint32_t (it->height) << 16);
+        bin::write32bit (out, uint32_t (uint16_t (it->ref_x)) | uint32_t (uint16_t (it->ref_y)) << 16);
+    }
+    return !out.fail();
+}
+
+void
+prepare_index (archive_index& index, file_reader& archive, const TCHAR* src_name)
+{
+    file_info source = get_file_info (src_name);
+    tstring index_name = archive_index::sidecar_name (src_name);
+    if (!index.load (index_name, archive, source))
+    {
+        TCLOG << _T("Building archive index...\n");
+        index.build (archive, source);
+        if (!index.save (index_name))
+            TCLOG << index_name << _T(": unable to write archive index.\n");
+    }
+    archive.set_index (&index);
+}
+
+} // namespace xami
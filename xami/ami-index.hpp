@@ -0,0 +1,93 @@
+// -*- C++ -*-
+//! \file       ami-index.hpp
+//! \date       Sat Oct 17 15:02:47 2026
+//! \brief      persistent sidecar index of AMI archive entries.
+//
+// Copyright (C) 2014 morkt and the MuvLuvRu project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+
+#ifndef AMI_INDEX_HPP
+#define AMI_INDEX_HPP
+
+#include <vector>
+#include "ami-archive.hpp"
+
+namespace xami {
+
+// facts about archive entry that otherwise require to unpack it.
+struct entry_info
+{
+    uint32_t    id;
+    uint32_t    crc;            // CRC32 of the unpacked contents
+    entry_type  type;
+    unsigned    lines;          // number of text lines in script
+    uint16_t    width;          // image dimensions
+    uint16_t    height;
+    int16_t     ref_x;          // image reference point
+    int16_t     ref_y;
+
+    entry_info () : id (0), crc (0), type (entry_raw), lines (0)
+                  , width (0), height (0), ref_x (0), ref_y (0) { }
+};
+
+// index stored in the file alongside the archive.  it is bound to the archive size,
+// modification time and CRC32 of its table of contents, and is discarded when any of
+// these change.
+class archive_index
+{
+public:
+    archive_index () : m_size (0), m_time (0), m_crc (0) { }
+
+    // collect information about every entry of ARCHIVE, unpacking them all.
+    void build (const file_reader& archive, const file_info& source);
+
+    // read index from FILENAME.
+    // Returns: FALSE if there's no index or it doesn't match ARCHIVE.
+    bool load (const tstring& filename, const file_reader& archive, const file_info& source);
+
+    // Returns: FALSE if index couldn't be written into FILENAME.
+    bool save (const tstring& filename) const;
+
+    bool empty () const { return m_entries.empty(); }
+    unsigned count () const { return m_entries.size(); }
+
+    // info about the entry with sequence number SEQ.
+    const entry_info& operator[] (unsigned seq) const { return m_entries[seq]; }
+
+    // name of the index file for archive ARCHIVE_NAME.
+    static tstring sidecar_name (const tstring& archive_name) { return archive_name + _T(".idx"); }
+
+private:
+    static uint32_t toc_crc (const file_reader& archive);
+
+    size_t                  m_size;     // archive size
+    uint64_t                m_time;     // archive modification time
+    uint32_t                m_crc;      // CRC32 of archive table of contents
+    std::vector<entry_info> m_entries;  // indexed by entry sequence number
+};
+
+// load sidecar index of the archive SRC_NAME into INDEX, or build it if it's missing or
+// outdated, and attach it to ARCHIVE.
+void prepare_index (archive_index& index, file_reader& archive, const TCHAR* src_name);
+
+} // namespace xami
+
+#endif /* AMI_INDEX_HPP */
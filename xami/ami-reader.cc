@@ -25,12 +25,201 @@
 //
 
 #include "ami-archive.hpp"
+#include "ami-index.hpp"
 #include "xami-util.hpp"
 #include <sstream>
+#include <fstream>
 #include <iomanip>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 namespace xami {
 
+#ifdef _WIN32
+
+// PrefetchVirtualMemory is available since Windows 8 only.
+struct memory_range_entry
+{
+    void*   address;
+    size_t  size;
+};
+
+typedef BOOL (WINAPI *prefetch_virtual_memory_fn) (HANDLE, ULONG_PTR, memory_range_entry*, ULONG);
+
+static const prefetch_virtual_memory_fn g_prefetch_virtual_memory =
+    (prefetch_virtual_memory_fn)::GetProcAddress (::GetModuleHandleA ("kernel32.dll"),
+                                                  "PrefetchVirtualMemory");
+
+static void
+advise_willneed (const char* data, size_t size)
+{
+    if (g_prefetch_virtual_memory)
+    {
+        memory_range_entry range = { const_cast<char*> (data), size };
+        g_prefetch_virtual_memory (::GetCurrentProcess(), 1, &range, 0);
+    }
+}
+
+static void
+advise_sequential (const char*, size_t)
+{
+    // there's no way to change access pattern of the existing mapping.
+}
+
+#else
+
+static const char*
+page_align (const char* data, size_t& size)
+{
+    static const size_t page_size = ::sysconf (_SC_PAGESIZE);
+    size_t shift = reinterpret_cast<size_t> (data) % page_size;
+    size += shift;
+    return data - shift;
+}
+
+static void
+advise_willneed (const char* data, size_t size)
+{
+    data = page_align (data, size);
+    ::posix_madvise (const_cast<char*> (data), size, POSIX_MADV_WILLNEED);
+}
+
+static void
+advise_sequential (const char* data, size_t size)
+{
+    data = page_align (data, size);
+    ::posix_madvise (const_cast<char*> (data), size, POSIX_MADV_SEQUENTIAL);
+}
+
+#endif
+
+void file_reader::
+build_index ()
+{
+    m_index.resize (m_count);
+    for (unsigned i = 0; i < m_count; ++i)
+        m_index[i] = std::make_pair (entry_id (i), i);
+    // entries with equal ids stay in archive order, so find() returns the first one.
+    std::sort (m_index.begin(), m_index.end());
+}
+
+const size_t file_reader::max_whole_mapping;
+const size_t file_reader::window_size;
+
+void file_reader::
+map_data ()
+{
+    m_extent = 0;
+    for (unsigned i = 0; i < m_count; ++i)
+    {
+        const uint32_t* entry = header() + i * 4;
+        size_t offset = bin::little_dword (entry[1]);
+        size_t unpacked_size = bin::little_dword (entry[2]);
+        size_t packed_size = bin::little_dword (entry[3]);
+        m_extent = std::max (m_extent, offset + (packed_size ? packed_size : unpacked_size));
+    }
+    // entries of the truncated archive that run past the end of file are reported by span()
+    m_extent = static_cast<size_t> (std::min<uint64_t> (m_extent, m_in.size()));
+    m_window_offset = 0;
+    m_whole_mapped = m_extent <= max_whole_mapping;
+    if (m_whole_mapped && m_extent)
+        m_window = std::make_shared<data_window> (m_in, 0, m_extent);
+}
+
+archive_span file_reader::
+span (unsigned seq) const
+{
+    assert (seq < m_count && "Archive record index is out of range");
+    const uint32_t* entry = header() + seq * 4;
+
+    size_t offset = bin::little_dword (entry[1]);
+    size_t unpacked_size = bin::little_dword (entry[2]);
+    size_t packed_size = bin::little_dword (entry[3]);
+    size_t view_size = packed_size ? packed_size : unpacked_size;
+    if (!view_size)
+        return archive_span();
+    if (offset > m_extent || view_size > m_extent - offset)
+        throw std::runtime_error ("Archive entry is out of file bounds.");
+    if (m_whole_mapped)
+        return archive_span (m_window, m_window->begin() + offset, view_size);
+
+    std::lock_guard<std::mutex> guard (m_window_lock);
+    if (!m_window || offset < m_window_offset
+        || offset + view_size > m_window_offset + m_window->size())
+    {
+        size_t size = std::min (std::max (window_size, view_size), m_extent - offset);
+        m_window = std::make_shared<data_window> (m_in, offset, size);
+        m_window_offset = offset;
+    }
+    return archive_span (m_window, m_window->begin() + (offset - m_window_offset), view_size);
+}
+
+entry_type file_reader::
+classify (unsigned seq) const
+{
+    if (m_sidecar)
+        return (*m_sidecar)[seq].type;
+    const uint32_t* entry = header() + seq * 4;
+    size_t unpacked_size = bin::little_dword (entry[2]);
+    size_t packed_size = bin::little_dword (entry[3]);
+    if (unpacked_size <= GRP_HEADER_SIZE)
+        return entry_raw;
+    archive_span data = span (seq);
+    if (packed_size)
+    {
+        char signature[4];
+        if (sizeof(signature) == memory_inflate_head (data.data(), data.size(), signature, 4)
+            && 0 == std::memcmp (signature, "GRP", 4))
+            return entry_image;
+    }
+    else if (0 == std::memcmp (data.data(), "SCR", 4))
+        return entry_script;
+    return entry_raw;
+}
+
+void file_reader::
+advise (size_t offset, size_t size) const
+{
+    if (!size)
+        return;
+    if (m_whole_mapped)
+    {
+        if (m_window)
+            advise_willneed (m_window->begin() + offset, size);
+        return;
+    }
+    std::lock_guard<std::mutex> guard (m_window_lock);
+    if (!m_window || offset < m_window_offset || offset >= m_window_offset + m_window->size())
+        return;
+    size = std::min (size, m_window_offset + m_window->size() - offset);
+    advise_willneed (m_window->begin() + (offset - m_window_offset), size);
+}
+
+void file_reader::
+advise_sequential () const
+{
+    if (m_whole_mapped && m_window)
+        xami::advise_sequential (m_window->begin(), m_window->size());
+}
+
+bool file_reader::
+find (uint32_t id, unsigned& seq) const
+{
+    auto it = std::lower_bound (m_index.begin(), m_index.end(), std::make_pair (id, 0u));
+    if (it == m_index.end() || it->first != id)
+        return false;
+    seq = it->second;
+    return true;
+}
+
 void file_reader::
 read_content (content_type& content)
 {
@@ -50,18 +239,44 @@ read_content (content_type& content)
 size_t file_reader::
 copy_to (unsigned seq, std::ostream& out)
 {
-    assert (seq < m_count && "Archive record index is out of range");
-    const uint32_t* entry = m_header.begin() + seq * 4;
+    archive_span in = span (seq);
+    out.write (in.data(), in.size());
+    return in.size();
+}
 
-    uint32_t offset = bin::little_dword (entry[1]);
-    size_t unpacked_size = bin::little_dword (entry[2]);
-    size_t packed_size = bin::little_dword (entry[3]);
-    size_t view_size = packed_size ? packed_size : unpacked_size;
-    sys::mapping::const_view<char> in (m_in, offset, view_size);
-    out.write (in.begin(), view_size);
-    return view_size;
+#ifdef __linux__
+
+size_t file_reader::
+copy_range (uint64_t offset, size_t size, int fd, uint64_t dest_offset) const
+{
+    // copy_file_range shares extents on file systems that support reflinks, and is
+    // limited to the same file system on older kernels, where sendfile is tried instead.
+    loff_t in_offset = offset;
+    loff_t out_offset = dest_offset;
+    size_t copied = 0;
+    while (copied < size)
+    {
+        ssize_t rc = ::copy_file_range (m_in.handle(), &in_offset, fd, &out_offset,
+                                        size - copied, 0);
+        if (rc <= 0)
+            break;
+        copied += rc;
+    }
+    if (copied < size && ::lseek (fd, out_offset, SEEK_SET) == out_offset)
+    {
+        while (copied < size)
+        {
+            ssize_t rc = ::sendfile (fd, m_in.handle(), &in_offset, size - copied);
+            if (rc <= 0)
+                break;
+            copied += rc;
+        }
+    }
+    return copied;
 }
 
+#endif
+
 tstring converter::
 format_filename (uint32_t id, const TCHAR* ext)
 {
@@ -81,6 +296,13 @@ write_raw (uint32_t id, const char* buffer, size_t size)
     return true;
 }
 
+bool converter::
+write_packed (uint32_t id, entry_type, const char* zdata, size_t zsize, size_t)
+{
+    xami::write_inflated (format_filename (id, _T("dat")), zdata, zsize);
+    return true;
+}
+
 bool converter::
 write_script (uint32_t id, const char* scr_data, size_t size)
 {
@@ -97,4 +319,48 @@ write_image (uint32_t id, const char* grp_data, size_t size)
     return true;
 }
 
+bool converter::
+convert_script (uint32_t id, const char* scr_data, size_t size, std::vector<char>& out) const
+{
+    if (!check_script (scr_data, size))
+        return false;
+    std::ostringstream mlt;
+    if (!xami::write_script_mlt (mlt, id, scr_data, size, enc_shift_jis))
+        return false;
+    const std::string& text = mlt.str();
+    out.assign (text.begin(), text.end());
+    return true;
+}
+
+bool converter::
+convert_image (uint32_t, const char* grp_data, size_t size, std::vector<char>& out) const
+{
+    return xami::encode_png (grp_data, size, out);
+}
+
+bool converter::
+write_converted (uint32_t id, entry_type type, const char* data, size_t size)
+{
+    switch (type)
+    {
+    case entry_script:
+        {
+            tstring filename = format_filename (id, _T("mlt"));
+            if (!xami::write_raw (filename, data, size))
+                throw sys::file_error (filename);
+            break;
+        }
+    case entry_image:
+        {
+            tstring filename = format_filename (id, _T("png"));
+            if (!xami::write_raw (filename, data, size))
+                throw sys::file_error (filename);
+            break;
+        }
+    default:
+        return write_raw (id, data, size);
+    }
+    return true;
+}
+
 } // namespace xami
@@ -0,0 +1,125 @@
+// -*- C++ -*-
+//! \file       cp932-test.cc
+//! \date       Sat Oct 17 21:14:05 2026
+//! \brief      codepage 932 conversion tests.
+//
+// Copyright (C) 2014 morkt and the MuvLuvRu project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+
+#include "mltcomp.hpp"
+#include "xami-util.hpp"
+#include "cp932.hpp"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+int g_failed = 0;
+
+void
+check (bool cond, const char* what)
+{
+    if (!cond)
+    {
+        TCLOG << _T("FAILED: ") << what << std::endl;
+        ++g_failed;
+    }
+}
+
+bool
+contains (const std::vector<char>& data, const char* bytes)
+{
+    const char* end = bytes + std::strlen (bytes);
+    return std::search (data.begin(), data.end(), bytes, end) != data.end();
+}
+
+// em dash and guillemets are missing in codepage 932, system conversion substitutes them
+// with their "best fit" counterparts.
+void
+test_best_fit ()
+{
+    check (0x815c == ext::cp932::encode (0x2014), "U+2014 best fit");
+    check (0x81e1 == ext::cp932::encode (0x00ab), "U+00AB best fit");
+    check (0x81e2 == ext::cp932::encode (0x00bb), "U+00BB best fit");
+    check (0 == ext::cp932::encode (0x0e01), "U+0E01 has no mapping");
+
+    std::istringstream script ("\xef\xbb\xbf#FILENAME 00001234\n#TYPE 1\n"
+                               "<00000001> \xe2\x80\x94\xc2\xab\xc2\xbb\n");
+    std::ostringstream log;
+    xami::scr_compiler compiler;
+    compiler.set_log (log);
+    check (compiler.read_stream (script), "compile UTF-8 script");
+    std::vector<char> image;
+    compiler.compile_data (image);
+    check (contains (image, "\x81\x5c\x81\xe1\x81\xe2"), "compiled line matches system conversion");
+    check (log.str().empty(), "no conversion warnings");
+}
+
+// invalid sequences are decoded into KATAKANA MIDDLE DOT instead of aborting conversion.
+void
+test_invalid_sequence ()
+{
+    const char truncated[] = "a\x82";
+    const char* p = truncated;
+    check ('a' == ext::cp932::decode (p, truncated + 2), "ASCII character");
+    check (0x30fb == ext::cp932::decode (p, truncated + 2), "truncated lead byte");
+    check (p == truncated + 2, "truncated lead byte consumed");
+
+    const char bad_trail[] = "\x82\x20";
+    p = bad_trail;
+    check (0x30fb == ext::cp932::decode (p, bad_trail + 2), "invalid trail byte");
+    check (' ' == ext::cp932::decode (p, bad_trail + 2), "invalid trail byte kept");
+
+    // line that ends with a lead byte, as found in some original scripts
+    std::istringstream script ("#FILENAME 00001234\n#TYPE 1\n<00000001> abc\x82\n");
+    std::ostringstream log;
+    xami::scr_compiler compiler;
+    compiler.set_log (log);
+    check (compiler.read_stream (script), "compile Shift-JIS script");
+    std::vector<char> image;
+    compiler.compile_data (image);
+    std::ostringstream text;
+    bool written = false;
+    try
+    {
+        written = xami::write_script_txt (text, 0x1234, image.data(), image.size(), xami::enc_utf8);
+    }
+    catch (std::exception& X)
+    {
+        TCLOG << X.what() << std::endl;
+    }
+    check (written, "extract script with truncated lead byte");
+    check (text.str().find ("abc\xe3\x83\xbb") != std::string::npos, "truncated lead byte substituted");
+}
+
+} // anonymous namespace
+
+int
+main ()
+{
+    test_best_fit();
+    test_invalid_sequence();
+    if (g_failed)
+        return 1;
+    TCLOG << _T("all tests passed.\n");
+    return 0;
+}
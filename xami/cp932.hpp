@@ -0,0 +1,100 @@
+// -*- C++ -*-
+//! \file       cp932.hpp
+//! \date       Sat Oct 17 21:14:05 2026
+//! \brief      table-driven Shift-JIS (codepage 932) conversion.
+//
+// Copyright (C) 2014 morkt and the MuvLuvRu project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+
+#ifndef EXT_CP932_HPP
+#define EXT_CP932_HPP
+
+#include <cstdint>
+
+namespace ext { namespace cp932 {
+
+// tables follow Microsoft codepage 932 mapping, including NEC and IBM extensions and
+// user-defined area.  characters missing in the codepage are encoded with "best fit"
+// substitutes, same as the system conversion does.
+
+extern const uint16_t decode_table[60][189];
+extern const uint8_t  encode_index[256];
+extern const uint16_t encode_table[][256];
+
+// Returns: "best fit" substitute code for Unicode character C that has no exact
+// mapping in codepage 932, or 0 if there's none.
+unsigned best_fit (uint32_t c);
+
+// Returns: TRUE if C is the first byte of a two-byte character.
+inline bool is_lead_byte (uint8_t c)
+{
+    return (c >= 0x81 && c <= 0x9f) || (c >= 0xe0 && c <= 0xfc);
+}
+
+// default character substituted for invalid sequences, same as the system uses.
+const uint32_t default_char = 0x30fb;     // KATAKANA MIDDLE DOT
+
+// decode single Shift-JIS character at P into Unicode code point, advancing P past it.
+// Requires: P != LAST
+// Returns: converted character or default_char if P points to invalid sequence.  lead
+// byte followed by invalid trail byte is skipped alone, so that the trail byte is read
+// as a separate character.
+inline uint32_t decode (const char*& p, const char* last)
+{
+    uint8_t c = *p++;
+    if (c < 0x80)
+        return c;
+    if (c >= 0xa1 && c <= 0xdf)         // half-width katakana
+        return 0xff61 + (c - 0xa1);
+    if (!is_lead_byte (c))
+    {
+        switch (c)
+        {
+        case 0x80:  return 0x80;
+        case 0xa0:  return 0xf8f0;
+        default:    return 0xf8f1 + (c - 0xfd);
+        }
+    }
+    if (p == last)
+        return default_char;
+    uint8_t t = *p;
+    if (t < 0x40 || t > 0xfc || 0x7f == t)
+        return default_char;
+    ++p;
+    uint16_t code = decode_table[c < 0xe0 ? c - 0x81 : c - 0xc1][t - 0x40];
+    return code ? code : default_char;
+}
+
+// Returns: codepage 932 code of Unicode character C (double-byte codes are greater than
+// 0xff), or 0 if non-zero C could not be represented in this codepage.
+inline unsigned encode (uint32_t c)
+{
+    if (c < 0x80)
+        return c;
+    if (c > 0xffff)
+        return 0;
+    unsigned code = encode_table[encode_index[c >> 8]][c & 0xff];
+    return code ? code : best_fit (c);
+}
+
+} } // namespace ext::cp932
+
+#endif /* EXT_CP932_HPP */
@@ -25,10 +25,16 @@
 //
 
 #include "fileutil.hpp"
+#ifdef _WIN32
 #include "syshandle.h"
+#else
+#include <fcntl.h>
+#endif
 
 namespace ext {
 
+#ifdef _WIN32
+
 bool
 is_same_file (const TCHAR* lhs, const TCHAR* rhs)
 {
@@ -48,4 +54,52 @@ is_same_file (const TCHAR* lhs, const TCHAR* rhs)
     return false;
 }
 
+bool
+sync_file (const TCHAR* filename)
+{
+    sys::file_handle file (::CreateFile (filename, GENERIC_WRITE,
+                                         FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,
+                                         0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0));
+    return file && ::FlushFileBuffers (file);
+}
+
+bool
+sync_directory_of (const TCHAR*)
+{
+    return true;
+}
+
+#else
+
+bool
+is_same_file (const char* lhs, const char* rhs)
+{
+    struct stat info1;
+    struct stat info2;
+    if (0 == ::stat (lhs, &info1) && 0 == ::stat (rhs, &info2))
+        return info1.st_dev == info2.st_dev && info1.st_ino == info2.st_ino;
+    return false;
+}
+
+bool
+sync_file (const char* filename)
+{
+    int fd = ::open (filename, O_RDONLY);
+    if (-1 == fd)
+        return false;
+    bool rc = 0 == ::fsync (fd);
+    ::close (fd);
+    return rc;
+}
+
+bool
+sync_directory_of (const char* filename)
+{
+    const char* name = get_filename_part (filename);
+    std::string dir (filename, name);
+    return sync_file (dir.empty() ? "." : dir.c_str());
+}
+
+#endif
+
 } // namespace icase
@@ -24,16 +24,25 @@
 // IN THE SOFTWARE.
 //
 
-#include <windows.h>
-#include <tchar.h>
-
 #ifndef EXT_FILEUTIL_HPP
 #define EXT_FILEUTIL_HPP
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#endif
+#include <tchar.h>
 #include "stringutil.hpp"
 
 namespace ext {
 
+#ifdef _WIN32
+
+const TCHAR path_separator = _T('\\');
+
 inline bool file_exists (const char* filename)
 {
     DWORD rc = ::GetFileAttributesA (filename);
@@ -46,10 +55,65 @@ inline bool file_exists (const wchar_t* filename)
     return (INVALID_FILE_ATTRIBUTES != rc && !(FILE_ATTRIBUTE_DIRECTORY & rc));
 }
 
+inline bool is_directory (const char* path)
+{
+    DWORD rc = ::GetFileAttributesA (path);
+    return (INVALID_FILE_ATTRIBUTES != rc && (FILE_ATTRIBUTE_DIRECTORY & rc));
+}
+
+inline bool set_current_directory (const TCHAR* path)
+{
+    return ::SetCurrentDirectory (path) != 0;
+}
+
+// rename file FROM into TO, replacing TO if it exists.
+inline bool replace_file (const TCHAR* from, const TCHAR* to)
+{
+    return ::MoveFileEx (from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+inline bool delete_file (const TCHAR* filename)
+{
+    return ::DeleteFile (filename) != 0;
+}
+
+#else
+
+const TCHAR path_separator = '/';
+
+inline bool file_exists (const char* filename)
+{
+    struct stat st;
+    return 0 == ::stat (filename, &st) && S_ISREG (st.st_mode);
+}
+
+inline bool is_directory (const char* path)
+{
+    struct stat st;
+    return 0 == ::stat (path, &st) && S_ISDIR (st.st_mode);
+}
+
+inline bool set_current_directory (const char* path)
+{
+    return 0 == ::chdir (path);
+}
+
+inline bool replace_file (const char* from, const char* to)
+{
+    return 0 == std::rename (from, to);
+}
+
+inline bool delete_file (const char* filename)
+{
+    return 0 == ::unlink (filename);
+}
+
+#endif
+
 inline TCHAR*
 get_filename_part (TCHAR* path)
 {
-    TCHAR* filename = _tcsrchr (path, _T('\\'));
+    TCHAR* filename = _tcsrchr (path, path_separator);
     if (filename)
         return filename+1;
     else
@@ -70,6 +134,15 @@ compare_filename (const TCHAR* fullname, const TCHAR* filename)
 
 bool is_same_file (const TCHAR* lhs, const TCHAR* rhs);
 
+// write data of FILENAME cached by the system to disk.  data kept in stream buffers
+// should be flushed beforehand.
+// Returns: FALSE if file couldn't be opened or synchronized.
+bool sync_file (const TCHAR* filename);
+
+// write directory entry of newly created or deleted FILENAME to disk.  no-op on Windows,
+// where it's updated along with the file.
+bool sync_directory_of (const TCHAR* filename);
+
 } // namespace icase
 
 #endif /* EXT_FILEUTIL_HPP */
@@ -26,11 +26,162 @@
 
 #include "mltcomp.hpp"
 #include "binio.h"
+#include "cp932.hpp"
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <cctype>
+#include <cstring>
 
 namespace xami {
 
+// scanner of the script text held in memory.  mirrors the subset of std::istream
+// operations used by the parsers, so that scripts are read the same way they were read
+// from text mode streams.
+
+class text_cursor
+{
+    const char*     m_pos;
+    const char*     m_end;
+
+public:
+    text_cursor (const char* data, size_t size) : m_pos (data), m_end (data + size) { }
+
+    bool eof () const { return m_pos == m_end; }
+
+    int peek () const
+    {
+        if (m_pos == m_end)
+            return EOF;
+#ifdef _WIN32
+        if ('\r' == *m_pos && is_crlf (m_pos))
+            return '\n';
+#endif
+        return static_cast<unsigned char> (*m_pos);
+    }
+
+    bool get (char& c)
+    {
+        if (m_pos == m_end)
+            return false;
+#ifdef _WIN32
+        if ('\r' == *m_pos && is_crlf (m_pos))
+            ++m_pos;
+#endif
+        c = *m_pos++;
+        return true;
+    }
+
+    // move past the end of the current line.
+    // Returns: FALSE if there was no line end.
+    bool skip_line ()
+    {
+        const char* eol = find_eol();
+        m_pos = eol != m_end ? eol + 1 : m_end;
+        return eol != m_end;
+    }
+
+    // put the rest of the current line into LINE and move past its end.
+    void get_line (std::string& line)
+    {
+        const char* eol = find_eol();
+        const char* last = eol;
+#ifdef _WIN32
+        if (last != m_pos && '\r' == last[-1] && eol != m_end)
+            --last;
+#endif
+        line.assign (m_pos, last);
+        m_pos = eol != m_end ? eol + 1 : m_end;
+    }
+
+    void skip_space ()
+    {
+        while (m_pos != m_end && is_space (*m_pos))
+            ++m_pos;
+    }
+
+    // read hexadecimal number with optional 0x prefix, like operator>> with std::hex.
+    // Returns: FALSE if there's no number or it doesn't fit into unsigned.
+    bool get_hex (unsigned& number)
+    {
+        skip_space();
+        if (m_end - m_pos > 2 && '0' == m_pos[0] && ('x' == m_pos[1] || 'X' == m_pos[1])
+            && hex_digit (m_pos[2]) >= 0)
+            m_pos += 2;
+        const char* start = m_pos;
+        unsigned n = 0;
+        int digit;
+        for (; m_pos != m_end && (digit = hex_digit (*m_pos)) >= 0; ++m_pos)
+        {
+            if (n > 0x0fffffffu)
+                return false;
+            n = n << 4 | digit;
+        }
+        if (m_pos == start)
+            return false;
+        number = n;
+        return true;
+    }
+
+    // read decimal number, like operator>> with std::dec.
+    bool get_dec (unsigned& number)
+    {
+        skip_space();
+        const char* start = m_pos;
+        unsigned n = 0;
+        for (; m_pos != m_end && *m_pos >= '0' && *m_pos <= '9'; ++m_pos)
+        {
+            unsigned digit = *m_pos - '0';
+            if (n > (~0u - digit) / 10)
+                return false;
+            n = n * 10 + digit;
+        }
+        if (m_pos == start)
+            return false;
+        number = n;
+        return true;
+    }
+
+    // read whitespace-delimited word, like operator>> into std::string.
+    bool get_word (std::string& word)
+    {
+        skip_space();
+        const char* start = m_pos;
+        while (m_pos != m_end && !is_space (*m_pos))
+            ++m_pos;
+        word.assign (start, m_pos);
+        return m_pos != start;
+    }
+
+    static bool is_space (char c)
+    {
+        return ' ' == c || ('\t' <= c && c <= '\r');
+    }
+
+private:
+    const char* find_eol () const
+    {
+        const char* eol = static_cast<const char*> (std::memchr (m_pos, '\n', m_end - m_pos));
+        return eol ? eol : m_end;
+    }
+
+    bool is_crlf (const char* p) const { return p + 1 != m_end && '\n' == p[1]; }
+
+    static int hex_digit (char c)
+    {
+        static const signed char digits[256] = {
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+             0, 1, 2, 3, 4, 5, 6, 7, 8, 9,-1,-1,-1,-1,-1,-1,
+            -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+            -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        };
+        return static_cast<unsigned char> (c) < 0x70 ? digits[static_cast<unsigned char> (c)] : -1;
+    }
+};
+
 struct lang
 {
     translation_id lang_id;
@@ -51,33 +202,76 @@ ext::tostream& operator<< (ext::tostream& out, const lang& lng)
 }
 
 void scr_writer::
-add_line (translation_id lang_id, const line_data& line)
+add_line (translation_id lang_id, unsigned id, int line, const std::string& text)
 {
-    if (line.text[lang_id].empty())
+    if (text.empty())
     {
-        error_stream (line.line_no) << _T("empty line for [")
-            << to_hex (line.id) << _T('|') << lang (lang_id) << _T("] ignored.\n");
+        error_stream (line) << _T("empty line for [")
+            << to_hex (id) << _T('|') << lang (lang_id) << _T("] ignored.\n");
         return;
     }
-    auto it = text_map.find (line.id);
-    if (it != text_map.end())
+    if ((text_lines.size() + 1) * 2 > line_index.size())
+        rehash_index (line_index.empty() ? 16 : line_index.size() * 2);
+    unsigned& slot = index_slot (id);
+    if (slot)
     {
-        if (!it->second.text[lang_id].empty())
-            error_stream (line.line_no) << _T("duplicate line for [")
-                << to_hex (line.id) << _T('|') << lang (lang_id) << _T("] ignored.\n");
-        else
-            it->second.text[lang_id] = line.text[lang_id];
+        line_data& data = text_lines[slot-1];
+        if (data.size[lang_id])
+        {
+            error_stream (line) << _T("duplicate line for [")
+                << to_hex (id) << _T('|') << lang (lang_id) << _T("] ignored.\n");
+            return;
+        }
+        data.offset[lang_id] = text_pool.size();
+        data.size[lang_id] = text.size();
     }
     else
     {
-        text_map.insert (std::make_pair (line.id, line));
-        text_id_data.push_back (line.id);
+        line_data data = { id, line, { 0, 0, 0 }, { 0, 0, 0 } };
+        data.offset[lang_id] = text_pool.size();
+        data.size[lang_id] = text.size();
+        text_lines.push_back (data);
+        slot = text_lines.size();
     }
+    text_pool.insert (text_pool.end(), text.begin(), text.end());
+    text_pool.push_back (0);
+}
+
+void scr_writer::
+reserve (size_t lines, size_t text_size)
+{
+    text_lines.reserve (lines);
+    text_pool.reserve (text_size + 1);
+    size_t index_size = line_index.empty() ? 16 : line_index.size();
+    while (index_size < lines * 2)
+        index_size *= 2;
+    if (index_size > line_index.size())
+        rehash_index (index_size);
+}
+
+unsigned& scr_writer::
+index_slot (unsigned id)
+{
+    // line_index size is a power of two and it's never more than half full
+    size_t mask = line_index.size() - 1;
+    size_t pos = (id * 0x9e3779b1u) & mask;
+    while (line_index[pos] && text_lines[line_index[pos]-1].id != id)
+        pos = (pos + 1) & mask;
+    return line_index[pos];
+}
+
+void scr_writer::
+rehash_index (size_t size)
+{
+    line_index.assign (size, 0);
+    for (size_t i = 0; i < text_lines.size(); ++i)
+        index_slot (text_lines[i].id) = i + 1;
 }
 
 void scr_writer::
 convert_string (const std::string& input, std::string& out)
 {
+    out.clear();
     out.reserve (input.size());
     for (auto p = input.begin(); p != input.end(); )
     {
@@ -118,7 +312,8 @@ convert_string (const std::string& input, std::string& out)
 void scr_writer::
 convert_string_utf8 (const std::string& input, std::string& out)
 {
-    std::wstring wstr;
+    out.clear();
+    out.reserve (input.size());
     for (auto p = input.begin(); p != input.end(); )
     {
 	// P is updated by u8tou32
@@ -154,55 +349,72 @@ convert_string_utf8 (const std::string& input, std::string& out)
                 else if ('/' == c && '/' == *p)
                     break;
             }
-            wstr.push_back (static_cast<wchar_t> (c));
         }
-        else
+        if (c < 0x80)
+        {
+            out.push_back (static_cast<char> (c));
+            continue;
+        }
+        unsigned code = ext::cp932::encode (c);
+        if (!code)
         {
-            c -= 0x10000;
-            wstr.push_back (static_cast<wchar_t> (0xd800 + (c >> 10)));
-            wstr.push_back (static_cast<wchar_t> (0xdc00 + (c & 0x3ff)));
+            error_stream() << _T("character U+") << std::hex << std::uppercase << c
+                           << std::dec << std::nouppercase
+                           << _T(" cannot be represented in Shift-JIS encoding.\n");
+            code = '?';
         }
+        if (code > 0xff)
+            out.push_back (static_cast<char> (code >> 8));
+        out.push_back (static_cast<char> (code));
     }
-    ext::wcstombs (wstr, out, 932);
 }
 
 size_t scr_writer::
-compile_data (std::ostream& out) const
+compile_data (std::vector<char>& image) const
 {
-    out.write ("SCR", 4);
-    bin::write32bit (out, scr_type);
-    bin::write32bit (out, text_id_data.size());
-    uint32_t current_offset = 12 + 4 * 3 * text_id_data.size();
-    for (auto it = text_id_data.begin(); it != text_id_data.end(); ++it)
-    {
-        auto ptxt = text_map.find (*it);
-        if (g_warning)
-        {
-            auto lang_id = ptxt->second.get_lang();
-            if (tr_ru != lang_id)
-                error_stream (ptxt->second.line_no)
-                    << _T("no russian line for [") << to_hex (*it) << _T("]\n");
-        }
-        size_t text_size = ptxt->second.get_text().size();
-        bin::write32bit (out, current_offset);
-        bin::write32bit (out, text_size);
-        bin::write32bit (out, *it);
-        current_offset += text_size + 1;
-    }
-    for (auto it = text_id_data.begin(); it != text_id_data.end(); ++it)
+    // header and table of line offsets are followed by null-terminated lines text
+    const size_t count = text_lines.size();
+    const size_t table_size = 12 + 4 * 3 * count;
+    size_t total_size = table_size;
+    for (auto it = text_lines.begin(); it != text_lines.end(); ++it)
+        total_size += it->size[it->get_lang()] + 1;
+    image.resize (total_size);
+
+    uint32_t* table = reinterpret_cast<uint32_t*> (&image[0]);
+    std::memcpy (table++, "SCR", 4);
+    *table++ = bin::little_dword (scr_type);
+    *table++ = bin::little_dword (count);
+    char* text = &image[table_size];
+    for (auto it = text_lines.begin(); it != text_lines.end(); ++it)
     {
-        auto ptxt = text_map.find (*it);
-        const std::string& text = ptxt->second.get_text();
-        out.write (text.c_str(), text.size()+1);
+        auto lang_id = it->get_lang();
+        if (g_warning && tr_ru != lang_id)
+            error_stream (it->line_no)
+                << _T("no russian line for [") << to_hex (it->id) << _T("]\n");
+        size_t text_size = it->size[lang_id];
+        *table++ = bin::little_dword (text - &image[0]);
+        *table++ = bin::little_dword (text_size);
+        *table++ = bin::little_dword (it->id);
+        std::memcpy (text, get_text (*it, lang_id), text_size + 1);
+        text += text_size + 1;
     }
-    return current_offset;
+    return total_size;
+}
+
+size_t scr_writer::
+compile_data (std::ostream& out) const
+{
+    std::vector<char> image;
+    size_t size = compile_data (image);
+    out.write (image.data(), size);
+    return size;
 }
 
 // ---------------------------------------------------------------------------
 // MLT script interpreter
 
 boost::tribool mlt_compiler::
-read_line (std::istream& in, unsigned& line_id, std::string& line, translation_id& lang_id)
+read_line (text_cursor& in, unsigned& line_id, std::string& line, translation_id& lang_id)
 {
     char c;
     do // skip whitespace
@@ -212,10 +424,10 @@ read_line (std::istream& in, unsigned& line_id, std::string& line, translation_i
         if ('\n' == c) // skip blank lines
             return boost::indeterminate;
     }
-    while (std::isspace (c));
+    while (text_cursor::is_space (c));
     if (';' == c) // skip comments
     {
-        return skip_until_eol (in) ? boost::indeterminate : boost::tribool(false);
+        return in.skip_line() ? boost::indeterminate : boost::tribool(false);
     }
     if ('[' != c)
     {
@@ -223,11 +435,15 @@ read_line (std::istream& in, unsigned& line_id, std::string& line, translation_i
         throw syntax_error();
     }
 
-    in >> std::hex >> line_id;
+    if (!in.get_hex (line_id))
+    {
+        error_stream() << _T("syntax error (expected ']', got '") << c << _T("').\n");
+        throw syntax_error();
+    }
     lang_id = tr_ru;
     if ('|' == in.peek())
     {
-        in.get();
+        in.get (c);
         std::string lang;
         while (in.get (c) && ']' != c)
         {
@@ -254,34 +470,44 @@ read_line (std::istream& in, unsigned& line_id, std::string& line, translation_i
         throw syntax_error();
     }
     if (' ' == in.peek())
-        in.get();
+        in.get (c);
 
-    std::getline (in, line);
+    in.get_line (line);
     return true;
 }
 
 bool mlt_compiler::
 read_stream (std::istream& in)
+{
+    std::ostringstream text;
+    text << in.rdbuf();
+    const std::string& data = text.str();
+    return read_data (data.data(), data.size());
+}
+
+bool mlt_compiler::
+read_data (const char* data, size_t size)
 {
     line_no = 1;
     encoding = enc_shift_jis;
-    char sig[3];
-    in.read (sig, 3);
-    if ('\xef' == sig[0] && '\xbb' == sig[1] && '\xbf' == sig[2])
+    if (size >= 3 && 0 == std::memcmp (data, "\xef\xbb\xbf", 3))
     {
         encoding = enc_utf8;
-        in.read (sig, 3);
+        data += 3;
+        size -= 3;
     }
-    if (!in || 0 != std::memcmp (sig, "SCR", 3))
+    if (size < 3 || 0 != std::memcmp (data, "SCR", 3))
     {
         error_stream() << _T("invalid input file.\n");
         return false;
     }
-    in >> scr_type;
-    if (in.peek() != '\n')
+    text_cursor in (data + 3, size - 3);
+    bool valid = in.get_dec (scr_type);
+    if (!valid || in.peek() != '\n')
     {
         std::string enc;
-        in >> enc;
+        if (valid)
+            in.get_word (enc);
         icase::tolower (enc);
         if ("shift-jis" != enc)
         {
@@ -294,19 +520,20 @@ read_stream (std::istream& in)
             }
         }
     }
-    skip_until_eol (in);
+    in.skip_line();
     ++line_no;
     unsigned total_lines;
-    in >> total_lines;
-    if (!skip_until_eol (in))
+    if (!in.get_dec (total_lines) || !in.skip_line())
     {
         error_stream() << _T("unexpected end of file.\n");
         return false;
     }
     auto f_convert_string = enc_shift_jis == encoding ? &mlt_compiler::convert_string
                                                       : &mlt_compiler::convert_string_utf8;
-    std::string line_text;
-    while (in)
+    // line count comes from the file, don't let a broken header allocate more than its size
+    reserve (std::min<size_t> (total_lines, size / 4), size);
+    std::string line_text, converted;
+    while (!in.eof())
     {
         ++line_no;
         unsigned line_id;
@@ -314,21 +541,15 @@ read_stream (std::istream& in)
         auto result = read_line (in, line_id, line_text, lang_id);
         if (result)
         {
-            line_data line = { line_id, line_no };
-            (this->*f_convert_string) (line_text, line.text[lang_id]);
-            add_line (lang_id, line);
+            (this->*f_convert_string) (line_text, converted);
+            add_line (lang_id, line_id, line_no, converted);
         }
         else if (!result)
             break;
     }
-//    std::cout << input_name << ": [" << sig << " " << scr_id << "] "
-//              << text_id_data.size() << " entries parsed";
-//    if (text_id_data.size() != total_lines)
-//        std::cout << " (expected " << total_lines << ')';
-//    std::cout << std::endl;
-    if (text_id_data.size() != total_lines)
-        TCLOG << input_name << _T(": expected ") << total_lines
-            << _T(" lines, got ") << text_id_data.size() << _T(".\n");
+    if (text_lines.size() != total_lines)
+        *log_stream << input_name << _T(": expected ") << total_lines
+            << _T(" lines, got ") << text_lines.size() << _T(".\n");
     return true;
 }
 
@@ -336,21 +557,21 @@ read_stream (std::istream& in)
 // TXT script interpreter
 
 bool scr_compiler::
-read_header (std::istream& in)
+read_header (text_cursor& in)
 {
     std::string keyword;
-    if (!(in >> keyword))
+    if (!in.get_word (keyword))
         return false;
     if ("FILENAME" == keyword)
-        in >> std::hex >> out_id;
+        in.get_hex (out_id);
     else if ("TYPE" == keyword)
-        in >> std::dec >> scr_type;
-    skip_until_eol (in);
+        in.get_dec (scr_type);
+    in.skip_line();
     return true;
 }
 
 boost::tribool scr_compiler::
-read_line (std::istream& in, unsigned& line_id, std::string& line_text)
+read_line (text_cursor& in, unsigned& line_id, std::string& line_text)
 {
     char c;
     if (!in.get (c))
@@ -362,7 +583,7 @@ read_line (std::istream& in, unsigned& line_id, std::string& line_text)
         read_header (in);
         return boost::indeterminate;
     }
-    while (std::isspace (c)) // skip whitespace
+    while (text_cursor::is_space (c)) // skip whitespace
     {
         if (!in.get (c))
             return false;
@@ -371,7 +592,7 @@ read_line (std::istream& in, unsigned& line_id, std::string& line_text)
     }
     if ('/' == c && '/' == in.peek()) // skip comments
     {
-        return skip_until_eol (in) ? boost::indeterminate : boost::tribool(false);
+        return in.skip_line() ? boost::indeterminate : boost::tribool(false);
     }
     if ('<' != c)
     {
@@ -379,82 +600,100 @@ read_line (std::istream& in, unsigned& line_id, std::string& line_text)
         return signal_error (in);
     }
 
-    in >> std::hex >> line_id;
-    if (!in.get (c) || '>' != c)
+    if (!in.get_hex (line_id) || !in.get (c) || '>' != c)
     {
         error_stream() << _T("syntax error (expected '>', got '") << c << _T("').\n");
         return signal_error (in);
     }
     if (' ' == in.peek())
-        in.get();
+        in.get (c);
 
-    std::getline (in, line_text);
+    in.get_line (line_text);
     return true;
 }
 
 bool scr_compiler::
 read_stream (std::istream& in)
+{
+    std::ostringstream text;
+    text << in.rdbuf();
+    const std::string& data = text.str();
+    return read_data (data.data(), data.size());
+}
+
+bool scr_compiler::
+read_data (const char* data, size_t size)
 {
     line_no = 1;
-    if ('\xef' == in.peek())
+    if (size > 0 && '\xef' == data[0])
     {
-        in.get();
-        if ('\xbb' == in.get() && '\xbf' == in.get())
-            encoding = enc_utf8;
-        else
+        if (size < 3 || '\xbb' != data[1] || '\xbf' != data[2])
         {
             error_stream() << _T("invalid input file.\n");
             return false;
         }
+        encoding = enc_utf8;
+        data += 3;
+        size -= 3;
     }
-    if ('#' != in.peek())
+    if (!size || '#' != data[0])
     {
         error_stream() << _T("invalid input file.\n");
         return false;
     }
     auto f_convert_string = enc_shift_jis == encoding ? &scr_compiler::convert_string
                                                       : &scr_compiler::convert_string_utf8;
-    std::string line_text;
-    while (in)
+    text_cursor in (data, size);
+    reserve (0, size);
+    std::string line_text, converted;
+    while (!in.eof())
     {
         unsigned line_id;
         auto result = read_line (in, line_id, line_text);
         if (result)
         {
-            line_data line = { line_id, line_no };
-            (this->*f_convert_string) (line_text, line.text[tr_ru]);
-            add_line (tr_ru, line);
+            (this->*f_convert_string) (line_text, converted);
+            add_line (tr_ru, line_id, line_no, converted);
         }
         else if (!result)
             break;
         ++line_no;
     }
-//    std::cout << input_name << ": [" << sig << " " << scr_id << "] "
-//              << text_id_data.size() << " entries parsed\n";
     return true;
 }
 
 unsigned scr_compiler::
 get_id_from_file (const TCHAR* filename)
 {
-    std::ifstream in (filename);
-    char c;
-    if (!in || !in.get (c))
-        return 0;
-    if ('\xef' == c)
+    // header is expected within the first line, no need to read the whole file.
+    std::ifstream in (filename, std::ios::in|std::ios::binary);
+    char header[64];
+    in.read (header, sizeof(header));
+    return get_id_from_data (header, in.gcount());
+}
+
+unsigned scr_compiler::
+get_id_from_data (const char* data, size_t size)
+{
+    if (size >= 3 && 0 == std::memcmp (data, "\xef\xbb\xbf", 3))
     {
-        if ('\xbb' != in.get() || '\xbf' != in.get())
-            return 0;
-        in.get (c);
+        data += 3;
+        size -= 3;
     }
-    if ('#' != c)
-        return 0;
-    char keyword[8];
-    if (!in.read (keyword, 8) || 0 != std::memcmp (keyword, "FILENAME", 8))
+    if (size < 9 || 0 != std::memcmp (data, "#FILENAME", 9))
         return 0;
+    text_cursor cursor (data + 9, size - 9);
     unsigned id;
-    in >> std::hex >> id;
-    return id;
+    return cursor.get_hex (id) ? id : 0;
+}
+
+boost::tribool scr_writer::
+signal_error (text_cursor& in) const
+{
+    if (!ignore_errors)
+        throw syntax_error();
+    in.skip_line();
+    return boost::indeterminate;
 }
 
 } // namespace xami
@@ -29,7 +29,6 @@
 
 #include <iostream>
 #include <vector>
-#include <map>
 #include <boost/logic/tribool.hpp>
 #include <tchar.h>
 #include "xami-types.hpp"
@@ -43,6 +42,8 @@ struct syntax_error : std::runtime_error
     syntax_error () : std::runtime_error ("Syntax error in text script.") { }
 };
 
+class text_cursor;
+
 enum translation_id
 {
     tr_ru,
@@ -50,16 +51,17 @@ enum translation_id
     tr_jp,
 };
 
+// translations of the script line, text itself is kept in the text pool of scr_writer.
+// missing translation has zero size and refers to the empty string at the pool start.
 struct line_data
 {
     unsigned    id;
     int         line_no;
-    std::string text[3];
+    uint32_t    offset[3];
+    uint32_t    size[3];
 
     translation_id get_lang () const
-        { return text[tr_ru].empty() ? tr_en : tr_ru; }
-    const std::string& get_text () const
-        { return text[tr_ru].empty() ? text[tr_en] : text[tr_ru]; }
+        { return size[tr_ru] ? tr_ru : tr_en; }
 };
 
 class scr_writer
@@ -67,47 +69,55 @@ class scr_writer
 protected:
     unsigned                scr_type;
     encoding_id             encoding;
-    std::vector<unsigned>   text_id_data;
-    std::map<unsigned, line_data>
-                            text_map;
+    std::vector<line_data>  text_lines;     // in order of appearance
+    std::vector<unsigned>   line_index;     // open addressing, text_lines position + 1
+    std::vector<char>       text_pool;      // null-terminated line texts
     tstring                 input_name;
     int                     line_no;
     bool                    ignore_errors;
+    std::basic_ostream<TCHAR>*
+                            log_stream;
 
 public:
     explicit scr_writer (encoding_id enc = enc_shift_jis)
         : scr_type (0)
         , encoding (enc)
+        , text_pool (1, '\0')
         , input_name (_T("<stdin>"))
-        , ignore_errors (g_ignore_script_errors) {}
+        , ignore_errors (g_ignore_script_errors)
+        , log_stream (&TCLOG) {}
 
     void set_filename (tstring name) { input_name = std::move (name); }
+    // direct error messages into LOG instead of TCLOG.
+    void set_log (std::basic_ostream<TCHAR>& log) { log_stream = &log; }
+    // put compiled SCR image into IMAGE.
+    // Returns: size of the image.
+    size_t compile_data (std::vector<char>& image) const;
     size_t compile_data (std::ostream& out) const;
 
 protected:
-    static bool skip_until_eol (std::istream& in)
-    {
-        while (in && in.get() != '\n')
-            ;
-        return !in.fail();
-    }
-
     void convert_string (const std::string& input, std::string& out);
     void convert_string_utf8 (const std::string& input, std::string& out);
 
-    void add_line (translation_id lang_id, const line_data& line);
+    // add TEXT for language LANG_ID of the line ID, found at source line LINE.
+    void add_line (translation_id lang_id, unsigned id, int line, const std::string& text);
+
+    // preallocate space for LINES script lines with TEXT_SIZE bytes of text in total.
+    void reserve (size_t lines, size_t text_size);
+
+    const char* get_text (const line_data& line, translation_id lang_id) const
+        { return &text_pool[line.offset[lang_id]]; }
 
     std::basic_ostream<TCHAR>& error_stream (int line) const
-        { return TCLOG << input_name << _T(':') << line << _T(": "); }
+        { return *log_stream << input_name << _T(':') << line << _T(": "); }
     std::basic_ostream<TCHAR>& error_stream () const { return error_stream (line_no); }
 
-    boost::tribool signal_error (std::istream& in) const
-    {
-        if (!ignore_errors)
-            throw syntax_error();
-        skip_until_eol (in);
-        return boost::indeterminate;
-    }
+    boost::tribool signal_error (text_cursor& in) const;
+
+private:
+    // Returns: slot of line_index that holds line ID, or empty slot where it belongs.
+    unsigned& index_slot (unsigned id);
+    void rehash_index (size_t size);
 };
 
 class mlt_compiler : public scr_writer
@@ -117,9 +127,12 @@ public:
 
     bool read_stream (std::istream& in);
 
+    // parse script text of SIZE bytes at DATA, usually mapped from file.
+    bool read_data (const char* data, size_t size);
+
 private:
     // false = abort, true = valid line, indeterminate = ignore line
-    boost::tribool read_line (std::istream& in, unsigned& line_id, std::string& line,
+    boost::tribool read_line (text_cursor& in, unsigned& line_id, std::string& line,
                               translation_id& lang_id);
 };
 
@@ -135,11 +148,18 @@ public:
 
     bool read_stream (std::istream& in);
 
+    // parse script text of SIZE bytes at DATA, usually mapped from file.
+    bool read_data (const char* data, size_t size);
+
+    // get script identifier from the header of FILENAME, without parsing the rest.
     static unsigned get_id_from_file (const TCHAR* filename);
 
+    // get script identifier from the header of script text of SIZE bytes at DATA.
+    static unsigned get_id_from_data (const char* data, size_t size);
+
 private:
-    boost::tribool read_line (std::istream& in, unsigned& id, std::string& line);
-    bool read_header (std::istream& in);
+    boost::tribool read_line (text_cursor& in, unsigned& id, std::string& line);
+    bool read_header (text_cursor& in);
 };
 
 struct to_hex
@@ -30,6 +30,7 @@
 #include <iomanip>
 #include <iterator>
 #include "mltcomp.hpp"
+#include "cp932.hpp"
 #include "tinyformat.h"
 
 namespace xami {
@@ -104,19 +105,21 @@ struct convert_string_utf8
     EscapeChar escape_char;
     std::string operator () (const char* text, size_t size)
     {
-        if (!size)
-            return std::string();
-        std::wstring wtext;
-        if (!ext::mbstowcs (text, size, wtext, 932))
-            throw std::runtime_error ("Cannot convert script from japanese Shift-JIS encoding to Unicode.");
-
         std::string out;
-        for (auto it = wtext.cbegin(); it != wtext.cend(); )
+        out.reserve (size + size / 2);
+        const char* const last = text + size;
+        for (const char* p = text; p != last; )
         {
-            // iterator IT is updated by u16tou32
-            uint32_t c = ext::u16tou32 (it, wtext.cend());
+            // pointer P is updated by cp932::decode, invalid sequences are substituted
+            uint32_t c = ext::cp932::decode (p, last);
             escape_char (out, c, [] (std::string& s, uint32_t c) {
-                ext::u32tou8 (c, std::back_inserter (s));
+                if (c < 0x80)
+                    s += static_cast<char> (c);
+                else
+                {
+                    auto out = std::back_inserter (s);
+                    ext::u32tou8 (c, out);
+                }
             }); 
         }
         return out;
@@ -233,6 +236,26 @@ write_script (uint32_t file_id, const char* scr_data, size_t size,
     return result;
 }
 
+bool
+check_script (const char* scr_data, size_t size)
+{
+    if (size <= 12)
+        return false;
+    const uint32_t* header = reinterpret_cast<const uint32_t*> (scr_data);
+    size_t count = bin::little_dword (header[2]);
+    if (count > (size - 12) / 12)
+        return false;
+    const uint32_t* entry = header + 3;
+    for (size_t i = 0; i < count; ++i, entry += 3)
+    {
+        size_t offset = bin::little_dword (entry[0]);
+        size_t line_size = bin::little_dword (entry[1]);
+        if (offset >= size || line_size > size || line_size + offset > size)
+            return false;
+    }
+    return true;
+}
+
 template <class Writer, class EscapeChar>
 inline bool write_script_enc (std::ostream& out, uint32_t file_id, const char* scr_data,
                               size_t size, encoding_id enc)
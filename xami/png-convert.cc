@@ -159,21 +159,23 @@ public:
     png_infop end () const { return end_info; }
 };
 
-error
-encode (const tstring& filename, const uint8_t* const pixel_data,
-        unsigned width, unsigned height, int off_x, int off_y)
+void
+write_vector (png_structp png_ptr, png_bytep data, png_size_t length)
 {
-    if (!width || !height)
-        return error::params;
-
-    write_struct png;
-    if (!png.create())
-        return error::init;
+    void* io_ptr = png_get_io_ptr (png_ptr);
+    std::vector<char>* out = static_cast<std::vector<char>*> (io_ptr);
+    out->insert (out->end(), (const char*)data, (const char*)data + length);
+}
 
-    std::ofstream out (filename, std::ios::out|std::ios::binary|std::ios::trunc);
-    if (!out)
-        return error::io;
+void
+flush_vector (png_structp)
+{
+}
 
+error
+write_image (write_struct& png, void* io_ptr, png_rw_ptr write_fn, png_flush_ptr flush_fn,
+             const uint8_t* const pixel_data, unsigned width, unsigned height, int off_x, int off_y)
+{
     // ---------------------------------------------------------------------------
     // no local objects should be declared below this point
     //
@@ -187,7 +189,7 @@ encode (const tstring& filename, const uint8_t* const pixel_data,
     if (!has_transparency (pixel_data, width, height))
         color_type = PNG_COLOR_TYPE_RGB;
 
-    png_set_write_fn (png.png_ptr, &out, write_stream, flush_stream);
+    png_set_write_fn (png.png_ptr, io_ptr, write_fn, flush_fn);
     png_set_IHDR (png.png_ptr, png.info_ptr, width, height, 8, color_type,
                   PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
     if (off_x || off_y)
@@ -209,6 +211,40 @@ encode (const tstring& filename, const uint8_t* const pixel_data,
     return error::none;
 }
 
+error
+encode (const tstring& filename, const uint8_t* const pixel_data,
+        size_t width, size_t height, int off_x, int off_y)
+{
+    if (!width || !height)
+        return error::params;
+
+    write_struct png;
+    if (!png.create())
+        return error::init;
+
+    std::ofstream out (filename, std::ios::out|std::ios::binary|std::ios::trunc);
+    if (!out)
+        return error::io;
+
+    return write_image (png, &out, write_stream, flush_stream,
+                        pixel_data, width, height, off_x, off_y);
+}
+
+error
+encode (std::vector<char>& out, const uint8_t* const pixel_data,
+        size_t width, size_t height, int off_x, int off_y)
+{
+    if (!width || !height)
+        return error::params;
+
+    write_struct png;
+    if (!png.create())
+        return error::init;
+
+    return write_image (png, &out, write_vector, flush_vector,
+                        pixel_data, width, height, off_x, off_y);
+}
+
 error
 decode (const tstring& filename, std::vector<uint8_t>& bgr_data,
         unsigned* const width, unsigned* const height, int* const off_x, int* const off_y)
@@ -52,6 +52,10 @@ enum error {
 error encode (const tstring& to_file, const uint8_t* const bgr_data,
               size_t width, size_t height, int off_x = 0, int off_y = 0);
 
+// same as above, but append PNG stream to the OUT buffer instead of writing it into file.
+error encode (std::vector<char>& out, const uint8_t* const bgr_data,
+              size_t width, size_t height, int off_x = 0, int off_y = 0);
+
 error decode (const tstring& from_file, std::vector<uint8_t>& bgr_data,
               unsigned* const width, unsigned* const height,
               int* const off_x = 0, int* const off_y = 0);
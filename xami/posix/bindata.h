@@ -0,0 +1,28 @@
+// -*- C++ -*-
+//! \file       posix/bindata.h
+//! \date       Sat Oct 17 16:21:40 2026
+//! \brief      byte order conversion subset of sys++ for non-Windows builds.
+//
+
+#ifndef XAMI_POSIX_BINDATA_H
+#define XAMI_POSIX_BINDATA_H
+
+#include <cstdint>
+
+namespace bin {
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+
+inline uint16_t little_word (uint16_t w) { return __builtin_bswap16 (w); }
+inline uint32_t little_dword (uint32_t dw) { return __builtin_bswap32 (dw); }
+
+#else
+
+inline uint16_t little_word (uint16_t w) { return w; }
+inline uint32_t little_dword (uint32_t dw) { return dw; }
+
+#endif
+
+} // namespace bin
+
+#endif /* XAMI_POSIX_BINDATA_H */
@@ -0,0 +1,29 @@
+// -*- C++ -*-
+//! \file       posix/binio.h
+//! \date       Sat Oct 17 16:22:12 2026
+//! \brief      binary stream output subset of sys++ for non-Windows builds.
+//
+
+#ifndef XAMI_POSIX_BINIO_H
+#define XAMI_POSIX_BINIO_H
+
+#include <ostream>
+#include "bindata.h"
+
+namespace bin {
+
+inline std::ostream& write16bit (std::ostream& out, uint16_t w)
+{
+    w = little_word (w);
+    return out.write (reinterpret_cast<const char*> (&w), 2);
+}
+
+inline std::ostream& write32bit (std::ostream& out, uint32_t dw)
+{
+    dw = little_dword (dw);
+    return out.write (reinterpret_cast<const char*> (&dw), 4);
+}
+
+} // namespace bin
+
+#endif /* XAMI_POSIX_BINIO_H */
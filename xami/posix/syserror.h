@@ -0,0 +1,45 @@
+// -*- C++ -*-
+//! \file       posix/syserror.h
+//! \date       Sat Oct 17 16:23:30 2026
+//! \brief      sys++ error classes for non-Windows builds.
+//
+
+#ifndef XAMI_POSIX_SYSERROR_H
+#define XAMI_POSIX_SYSERROR_H
+
+#include <string>
+#include <exception>
+#include <cerrno>
+#include <cstring>
+
+namespace sys {
+
+class generic_error : public std::exception
+{
+public:
+    explicit generic_error (const std::string& text) : m_text (text) { }
+    ~generic_error () throw() { }
+
+    const char* what () const throw() { return m_text.c_str(); }
+
+    template <typename CharT>
+    const CharT* get_description () const { return m_text.c_str(); }
+
+private:
+    std::string     m_text;
+};
+
+class file_error : public generic_error
+{
+public:
+    explicit file_error (const std::string& filename)
+        : generic_error (filename + ": " + std::strerror (errno)) { }
+    file_error (int error_code, const std::string& filename)
+        : generic_error (filename + ": " + std::strerror (error_code)) { }
+    file_error (const std::string& filename, const std::string& text)
+        : generic_error (filename + ": " + text) { }
+};
+
+} // namespace sys
+
+#endif /* XAMI_POSIX_SYSERROR_H */
@@ -0,0 +1,110 @@
+// -*- C++ -*-
+//! \file       posix/sysmemmap.h
+//! \date       Sat Oct 17 16:25:02 2026
+//! \brief      read-only file mappings subset of sys++ for non-Windows builds.
+//
+
+#ifndef XAMI_POSIX_SYSMEMMAP_H
+#define XAMI_POSIX_SYSMEMMAP_H
+
+#include <string>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "syserror.h"
+
+namespace sys { namespace mapping {
+
+class readonly
+{
+public:
+    explicit readonly (const std::string& filename) : m_fd (::open (filename.c_str(), O_RDONLY))
+    {
+        struct stat st;
+        if (-1 == m_fd || -1 == ::fstat (m_fd, &st))
+        {
+            int err = errno;
+            if (-1 != m_fd)
+                ::close (m_fd);
+            throw file_error (err, filename);
+        }
+        m_size = st.st_size;
+    }
+    ~readonly () { ::close (m_fd); }
+
+    int handle () const { return m_fd; }
+    uint64_t size () const { return m_size; }
+
+private:
+    readonly (const readonly&);             // not defined
+    readonly& operator= (const readonly&);
+
+    int         m_fd;
+    uint64_t    m_size;
+};
+
+// view of COUNT objects of type T starting at byte OFFSET of the mapped file.  zero COUNT
+// means up to the end of file.
+template <class T>
+class const_view
+{
+public:
+    typedef const T*    const_iterator;
+
+    explicit const_view (const readonly& in, uint64_t offset = 0, size_t count = 0)
+        : m_map (MAP_FAILED), m_map_size (0), m_data (0), m_count (0)
+    {
+        remap (in, offset, count);
+    }
+    ~const_view () { unmap(); }
+
+    void remap (const readonly& in, uint64_t offset, size_t count)
+    {
+        unmap();
+        if (offset > in.size())
+            throw generic_error ("mapping offset is out of file bounds");
+        if (!count)
+            count = (in.size() - offset) / sizeof(T);
+        static const uint64_t page_size = ::sysconf (_SC_PAGESIZE);
+        uint64_t map_offset = offset - offset % page_size;
+        size_t shift = offset - map_offset;
+        m_map_size = shift + count * sizeof(T);
+        if (!m_map_size)
+            return;
+        m_map = ::mmap (0, m_map_size, PROT_READ, MAP_SHARED, in.handle(), map_offset);
+        if (MAP_FAILED == m_map)
+            throw file_error (errno, "mmap");
+        m_data = reinterpret_cast<const T*> (static_cast<const char*> (m_map) + shift);
+        m_count = count;
+    }
+
+    const T* begin () const { return m_data; }
+    const T* end () const { return m_data + m_count; }
+    size_t size () const { return m_count; }
+    const T& operator[] (size_t i) const { return m_data[i]; }
+
+private:
+    const_view (const const_view&);         // not defined
+    const_view& operator= (const const_view&);
+
+    void unmap ()
+    {
+        if (MAP_FAILED != m_map)
+            ::munmap (m_map, m_map_size);
+        m_map = MAP_FAILED;
+        m_data = 0;
+        m_count = 0;
+    }
+
+    void*       m_map;
+    size_t      m_map_size;
+    const T*    m_data;
+    size_t      m_count;
+};
+
+} } // namespace sys::mapping
+
+#endif /* XAMI_POSIX_SYSMEMMAP_H */
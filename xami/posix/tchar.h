@@ -0,0 +1,20 @@
+// -*- C++ -*-
+//! \file       posix/tchar.h
+//! \date       Sat Oct 17 16:20:05 2026
+//! \brief      TCHAR mappings for non-Windows builds.
+//
+
+#ifndef XAMI_POSIX_TCHAR_H
+#define XAMI_POSIX_TCHAR_H
+
+#include <cstring>
+#include <cstdlib>
+
+typedef char TCHAR;
+
+#define _T(x)       x
+#define _tmain      main
+#define _tcsrchr    std::strrchr
+#define _tcstoul    std::strtoul
+
+#endif /* XAMI_POSIX_TCHAR_H */
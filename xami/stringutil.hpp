@@ -33,8 +33,14 @@
 #include <iosfwd>
 #include <cctype>	// for std::toupper/tolower
 #include <algorithm>
-#include <windows.h>
 #include <cassert>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <tchar.h>
+#include <strings.h>
+#include <cwchar>
+#endif
 
 #if defined(UNICODE) || defined(_UNICODE)
 #   define TCOUT std::wcout
@@ -70,6 +76,8 @@ struct cstr_less
 // ---------------------------------------------------------------------------
 // Unicode conversion functions
 
+#ifdef _WIN32
+
 int wcstombs (const wchar_t* wstr, size_t size, std::string& cstr, unsigned codepage);
 int mbstowcs (const char* cstr, size_t size, std::wstring& wstr, unsigned codepage);
 
@@ -113,6 +121,8 @@ inline int mbstowcs (const char* cstr, wchar_t* dst, size_t dst_size, unsigned c
     return ::MultiByteToWideChar (codepage, 0, cstr, -1, dst, dst_size);
 }
 
+#endif
+
 // u8tou32 (FIRST, LAST)
 // convert single UTF-8 character into Unicode code point.
 // Requires: FIRST != LAST
@@ -300,6 +310,8 @@ private:
 
 namespace icase {
 
+#ifdef _WIN32
+
 inline int strcmp (const char* lhs, const char* rhs)
 {
     return ::CompareStringA (LOCALE_INVARIANT, SORT_STRINGSORT|NORM_IGNORECASE,
@@ -324,6 +336,30 @@ inline int strncmp (const wchar_t* lhs, const wchar_t* rhs, size_t length)
                              lhs, length, rhs, length) - 2;
 }
 
+#else
+
+inline int strcmp (const char* lhs, const char* rhs)
+{
+    return ::strcasecmp (lhs, rhs);
+}
+
+inline int strcmp (const wchar_t* lhs, const wchar_t* rhs)
+{
+    return ::wcscasecmp (lhs, rhs);
+}
+
+inline int strncmp (const char* lhs, const char* rhs, size_t length)
+{
+    return ::strncasecmp (lhs, rhs, length);
+}
+
+inline int strncmp (const wchar_t* lhs, const wchar_t* rhs, size_t length)
+{
+    return ::wcsncasecmp (lhs, rhs, length);
+}
+
+#endif
+
 /// locase
 /// \brief functor providing conversion to lower case
 
@@ -0,0 +1,65 @@
+// -*- C++ -*-
+//! \file       task-progress.hpp
+//! \date       Sat Oct 17 16:48:51 2026
+//! \brief      interface between archive operations and their front-end.
+//
+// Copyright (C) 2014 morkt and the MuvLuvRu project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+
+#ifndef XAMI_TASK_PROGRESS_HPP
+#define XAMI_TASK_PROGRESS_HPP
+
+#include "xami-types.hpp"
+
+namespace xami {
+
+enum overwrite_answer
+{
+    overwrite_yes,
+    overwrite_no,
+    overwrite_cancel,
+};
+
+// receives progress of the long-running archive operation.  implemented by the dialog in
+// GUI, and by the console in command-line front-end.
+class task_progress
+{
+public:
+    virtual ~task_progress () { }
+
+    // COUNT is the number of steps the task is going to take.
+    virtual void set_max_range (unsigned count) = 0;
+
+    // advance to the next step, processing file FILENAME.
+    // Returns: FALSE if user requested to abort the task.
+    virtual bool next (const tstring& filename) = 0;
+
+    // advance to the next step without any file being processed.
+    virtual void step () = 0;
+
+    // ask whether existing file FILENAME should be overwritten.  APPLY_TO_ALL is set if the
+    // same answer should be used for all subsequent files.
+    virtual overwrite_answer confirm_overwrite (const tstring& filename, bool& apply_to_all) = 0;
+};
+
+} // namespace xami
+
+#endif /* XAMI_TASK_PROGRESS_HPP */
@@ -0,0 +1,183 @@
+// -*- C++ -*-
+//! \file       work-queue.hpp
+//! \date       Sat Oct 17 12:40:18 2026
+//! \brief      primitives connecting stages of the multi-threaded pipelines.
+//
+// Copyright (C) 2014 morkt and the MuvLuvRu project.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+
+#ifndef XAMI_WORK_QUEUE_HPP
+#define XAMI_WORK_QUEUE_HPP
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace xami {
+
+// ---------------------------------------------------------------------------
+/// \class bounded_queue
+/// \brief FIFO queue that blocks producers when CAPACITY items are waiting.
+
+template <class T>
+class bounded_queue
+{
+    std::deque<T>           m_queue;
+    size_t                  m_capacity;
+    bool                    m_closed;
+    bool                    m_cancelled;
+    std::mutex              m_lock;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+
+public:
+    explicit bounded_queue (size_t capacity)
+        : m_capacity (capacity ? capacity : 1), m_closed (false), m_cancelled (false)
+        { }
+
+    /// put ITEM at the end of the queue, waiting for free space if necessary.
+    /// Returns: FALSE if queue was cancelled.
+    bool push (T item)
+    {
+        std::unique_lock<std::mutex> guard (m_lock);
+        m_not_full.wait (guard, [&] { return m_cancelled || m_queue.size() < m_capacity; });
+        if (m_cancelled)
+            return false;
+        m_queue.push_back (std::move (item));
+        m_not_empty.notify_one();
+        return true;
+    }
+
+    /// take first item from the queue into ITEM, waiting for it if necessary.
+    /// Returns: FALSE if queue was cancelled, or closed and there's nothing left.
+    bool pop (T& item)
+    {
+        std::unique_lock<std::mutex> guard (m_lock);
+        m_not_empty.wait (guard, [&] { return m_cancelled || m_closed || !m_queue.empty(); });
+        if (m_cancelled || m_queue.empty())
+            return false;
+        item = std::move (m_queue.front());
+        m_queue.pop_front();
+        m_not_full.notify_one();
+        return true;
+    }
+
+    /// signal consumers that no more items will be pushed.
+    void close ()
+    {
+        std::lock_guard<std::mutex> guard (m_lock);
+        m_closed = true;
+        m_not_empty.notify_all();
+    }
+
+    /// discard queue contents and release all waiting threads.
+    void cancel ()
+    {
+        std::lock_guard<std::mutex> guard (m_lock);
+        m_cancelled = true;
+        m_queue.clear();
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+    }
+};
+
+// ---------------------------------------------------------------------------
+/// \class memory_budget
+/// \brief limits total amount of memory held by the items in flight.
+///
+/// a single request that exceeds the limit on its own is admitted when nothing else is
+/// allocated, so large entries don't stall the pipeline.
+
+class memory_budget
+{
+    size_t                  m_limit;
+    size_t                  m_used;
+    bool                    m_cancelled;
+    std::mutex              m_lock;
+    std::condition_variable m_released;
+
+public:
+    explicit memory_budget (size_t limit) : m_limit (limit), m_used (0), m_cancelled (false) { }
+
+    /// Returns: FALSE if budget was cancelled while waiting.
+    bool acquire (size_t size)
+    {
+        std::unique_lock<std::mutex> guard (m_lock);
+        m_released.wait (guard, [&] {
+            return m_cancelled || !m_used || m_used + size <= m_limit;
+        });
+        if (m_cancelled)
+            return false;
+        m_used += size;
+        return true;
+    }
+
+    void release (size_t size)
+    {
+        std::lock_guard<std::mutex> guard (m_lock);
+        m_used -= size;
+        m_released.notify_all();
+    }
+
+    void cancel ()
+    {
+        std::lock_guard<std::mutex> guard (m_lock);
+        m_cancelled = true;
+        m_released.notify_all();
+    }
+};
+
+// ---------------------------------------------------------------------------
+/// \class thread_group
+/// \brief set of threads joined on destruction.
+
+class thread_group
+{
+    std::vector<std::thread>    m_threads;
+
+    thread_group (const thread_group&);             // not defined
+    thread_group& operator= (const thread_group&);
+
+public:
+    thread_group () { }
+    ~thread_group () { join(); }
+
+    template <class Function>
+    void create (unsigned count, Function fun)
+    {
+        for (unsigned i = 0; i < count; ++i)
+            m_threads.push_back (std::thread (fun));
+    }
+
+    void join ()
+    {
+        for (auto it = m_threads.begin(); it != m_threads.end(); ++it)
+            if (it->joinable())
+                it->join();
+        m_threads.clear();
+    }
+};
+
+} // namespace xami
+
+#endif /* XAMI_WORK_QUEUE_HPP */
@@ -0,0 +1,395 @@
+// -*- C++ -*-
+//! \file       xami-cli.cc
+//! \date       Sat Oct 17 17:31:08 2026
+//! \brief      xAMI command-line front-end.
+//
+
+#include "ami-convert.hpp"
+#include "ami-create.hpp"
+#include "ami-index.hpp"
+#include "fileutil.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#ifndef _WIN32
+#include <unistd.h>
+#include <climits>
+#endif
+
+namespace {
+
+using namespace xami;
+
+const char usage_text[] =
+    "usage: xami-cli extract [OPTIONS] ARCHIVE [DIRECTORY]\n"
+    "       xami-cli create [OPTIONS] DIRECTORY ARCHIVE\n"
+    "       xami-cli patch [OPTIONS] DIRECTORY ARCHIVE\n"
+    "       xami-cli compact [OPTIONS] ARCHIVE\n"
+    "       xami-cli precompile [OPTIONS] DIRECTORY|LISTFILE\n"
+    "       xami-cli list [OPTIONS] ARCHIVE\n"
+    "\n"
+    "extract options:\n"
+    "  --no-texts    don't extract text scripts\n"
+    "  --no-images   don't extract images\n"
+    "  --txt, --xml  text scripts format (default is mlt)\n"
+    "  --grp         leave images in GRP format instead of PNG\n"
+    "  --zgrp        write images compressed as they're stored in archive\n"
+    "  --utf8        write text scripts in UTF-8 encoding\n"
+    "  --index       use sidecar index of the archive, building it if necessary\n"
+    "\n"
+    "create options:\n"
+    "  -s ARCHIVE    take entries missing in DIRECTORY from ARCHIVE\n"
+    "  --cache       reuse entries compiled by previous run, keeping them next to ARCHIVE\n"
+    "  --dedup       store identical entries once\n"
+    "  -z PRESET     compression preset: fast, default, max (default) or auto, which\n"
+    "                picks the best compression for each entry\n"
+    "\n"
+    "patch replaces entries of ARCHIVE with the files from DIRECTORY in place, compact\n"
+    "reclaims space left unused by patch.\n"
+    "\n"
+    "list prints identifier, type, sizes, CRC32 of the contents, image dimensions with\n"
+    "reference point and script lines count of every entry.  it accepts --no-texts,\n"
+    "--no-images and --index options.\n"
+    "\n"
+    "precompile converts PNG images within DIRECTORY, or listed in LISTFILE one per line,\n"
+    "into ZGRP files that are packed without recompression.  it accepts -z option.\n"
+    "\n"
+    "common options:\n"
+    "  -j N          number of worker threads (0 means number of CPU cores)\n"
+    "  -f            overwrite existing files\n"
+    "  -v            print names of the processed files\n";
+
+// progress of the task is reported into console, and existing files are overwritten
+// according to command line options, without asking.
+class console_progress : public task_progress
+{
+public:
+    explicit console_progress (bool verbose) : m_verbose (verbose), m_total (0), m_current (0) { }
+
+    void set_max_range (unsigned count) { m_total = count; }
+
+    bool next (const tstring& filename)
+    {
+        ++m_current;
+        if (m_verbose)
+            std::cout << '[' << m_current << '/' << m_total << "] " << filename << '\n';
+        return true;
+    }
+
+    void step () { ++m_current; }
+
+    overwrite_answer confirm_overwrite (const tstring&, bool& apply_to_all)
+    {
+        apply_to_all = true;
+        return overwrite_no;
+    }
+
+private:
+    bool        m_verbose;
+    unsigned    m_total;
+    unsigned    m_current;
+};
+
+// turn relative PATH into absolute, so that it stays valid after current directory is
+// changed.
+std::string
+absolute_path (const std::string& path)
+{
+#ifdef _WIN32
+    char full_path[MAX_PATH];
+    DWORD rc = ::GetFullPathNameA (path.c_str(), MAX_PATH, full_path, 0);
+    if (!rc || rc >= MAX_PATH)
+        return path;
+    return full_path;
+#else
+    if (path.empty() || '/' == path[0])
+        return path;
+    char cwd[PATH_MAX];
+    if (!::getcwd (cwd, sizeof(cwd)))
+        return path;
+    return std::string (cwd) + '/' + path;
+#endif
+}
+
+bool
+change_directory (const std::string& path)
+{
+    if (ext::set_current_directory (path.c_str()))
+        return true;
+    int err = last_error();
+    std::cerr << path << ": cannot access directory. " << get_error_text (err);
+    return false;
+}
+
+struct options
+{
+    extract_options extract;
+    pack_options    pack;
+    unsigned        workers;
+    bool            use_index;
+    bool            verbose;
+    std::string     source_archive;
+    std::vector<std::string> args;
+
+    options () : workers (0), use_index (false), verbose (false) { }
+};
+
+// Returns: FALSE if command line is invalid.
+bool
+parse_options (int argc, char* argv[], options& opt)
+{
+    opt.extract.overwrite = overwrite_never;
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg (argv[i]);
+        if ("-j" == arg && i+1 < argc)
+            opt.workers = std::strtoul (argv[++i], 0, 10);
+        else if ("-s" == arg && i+1 < argc)
+            opt.source_archive = argv[++i];
+        else if ("-z" == arg && i+1 < argc)
+        {
+            if (!parse_compression_preset (argv[++i], opt.pack.compression))
+            {
+                std::cerr << "xami-cli: unknown compression preset " << argv[i] << '\n';
+                return false;
+            }
+        }
+        else if ("-f" == arg)
+            opt.extract.overwrite = overwrite_always;
+        else if ("-v" == arg)
+            opt.verbose = true;
+        else if ("--no-texts" == arg)
+            opt.extract.extract_texts = false;
+        else if ("--no-images" == arg)
+            opt.extract.extract_images = false;
+        else if ("--txt" == arg)
+            opt.extract.script_format = file_txt;
+        else if ("--xml" == arg)
+            opt.extract.script_format = file_xml;
+        else if ("--grp" == arg)
+            opt.extract.image_format = file_grp;
+        else if ("--zgrp" == arg)
+            opt.extract.image_format = file_zgrp;
+        else if ("--utf8" == arg)
+            opt.extract.encoding = enc_utf8;
+        else if ("--index" == arg)
+            opt.use_index = true;
+        else if ("--cache" == arg)
+            opt.pack.use_cache = true;
+        else if ("--dedup" == arg)
+            opt.pack.dedup = true;
+        else if (!arg.empty() && '-' == arg[0])
+        {
+            std::cerr << "xami-cli: unknown option " << arg << '\n';
+            return false;
+        }
+        else
+            opt.args.push_back (arg);
+    }
+    return true;
+}
+
+int
+extract_command (options& opt)
+{
+    if (opt.args.empty() || opt.args.size() > 2)
+        return -1;
+    std::string src_name = absolute_path (opt.args[0]);
+    if (opt.args.size() > 1 && !change_directory (opt.args[1]))
+        return 1;
+
+    console_progress progress (opt.verbose);
+    extractor<file_converter> ami_file (src_name.c_str(), &progress, opt.extract);
+    archive_index index;
+    if (opt.use_index)
+        prepare_index (index, ami_file, src_name.c_str());
+    ami_file.set_workers (opt.workers);
+    progress.set_max_range (ami_file.count());
+
+    unsigned count = ami_file.extract();
+    extraction_report (count, ami_file.writer());
+    throughput_report (ami_file.bytes_read(), ami_file.elapsed());
+    return count == ami_file.count() ? 0 : 1;
+}
+
+int
+create_command (options& opt)
+{
+    if (opt.args.size() != 2)
+        return -1;
+    std::string dst_name = absolute_path (opt.args[1]);
+    std::string source_archive;
+    if (!opt.source_archive.empty())
+    {
+        source_archive = absolute_path (opt.source_archive);
+        if (ext::is_same_file (source_archive.c_str(), dst_name.c_str()))
+        {
+            std::cerr << "Destination and source archive should be different.\n";
+            return 1;
+        }
+    }
+    if (!change_directory (opt.args[0]))
+        return 1;
+
+    file_map file_table;
+    build_file_table (file_table);
+    if (file_table.empty())
+    {
+        std::cerr << opt.args[0] << ": neither images nor text scripts found.\n";
+        return 1;
+    }
+    if (overwrite_always != opt.extract.overwrite && ext::file_exists (dst_name.c_str()))
+    {
+        std::cerr << dst_name << ": file already exists.\n";
+        return 1;
+    }
+    console_progress progress (opt.verbose);
+    opt.pack.workers = opt.workers;
+    return pack_archive (dst_name, file_table, source_archive, progress, opt.pack) ? 0 : 1;
+}
+
+int
+patch_command (options& opt)
+{
+    if (opt.args.size() != 2)
+        return -1;
+    std::string archive = absolute_path (opt.args[1]);
+    if (!change_directory (opt.args[0]))
+        return 1;
+
+    file_map file_table;
+    build_file_table (file_table);
+    if (file_table.empty())
+    {
+        std::cerr << opt.args[0] << ": neither images nor text scripts found.\n";
+        return 1;
+    }
+    console_progress progress (opt.verbose);
+    opt.pack.workers = opt.workers;
+    return patch_archive (archive, file_table, progress, opt.pack) ? 0 : 1;
+}
+
+int
+compact_command (options& opt)
+{
+    if (opt.args.size() != 1)
+        return -1;
+    console_progress progress (opt.verbose);
+    return compact_archive (opt.args[0], progress, opt.workers) ? 0 : 1;
+}
+
+int
+list_command (options& opt)
+{
+    if (opt.args.size() != 1)
+        return -1;
+    std::string src_name = opt.args[0];
+    file_reader archive (src_name.c_str());
+    // without sidecar, index is built in memory and discarded
+    archive_index index;
+    if (opt.use_index)
+        prepare_index (index, archive, src_name.c_str());
+    else
+        index.build (archive, get_file_info (src_name.c_str()));
+
+    std::cout << std::setfill ('0') << std::hex;
+    for (unsigned seq = 0; seq < index.count(); ++seq)
+    {
+        const entry_info& info = index[seq];
+        if ((entry_script == info.type && !opt.extract.extract_texts)
+            || (entry_image == info.type && !opt.extract.extract_images))
+            continue;
+        const uint32_t* entry = archive.header() + seq * 4;
+        std::cout << std::setw (8) << info.id << ' '
+                  << (entry_image == info.type ? "image " : entry_script == info.type ? "script" : "raw   ")
+                  << std::dec << std::setfill (' ')
+                  << std::setw (10) << bin::little_dword (entry[2]) << ' '
+                  << std::setw (10) << bin::little_dword (entry[3]) << ' '
+                  << std::hex << std::setfill ('0') << std::setw (8) << info.crc << std::dec;
+        if (entry_image == info.type)
+            std::cout << ' ' << info.width << 'x' << info.height
+                      << " (" << info.ref_x << ',' << info.ref_y << ')';
+        else if (entry_script == info.type)
+            std::cout << ' ' << info.lines << " lines";
+        std::cout << '\n' << std::hex;
+    }
+    return 0;
+}
+
+int
+precompile_command (options& opt)
+{
+    if (opt.args.size() != 1)
+        return -1;
+    std::vector<file_info> images;
+    if (ext::is_directory (opt.args[0].c_str()))
+    {
+        if (!change_directory (opt.args[0]))
+            return 1;
+        // images that are older than their ZGRP counterparts are skipped
+        file_map file_table;
+        build_file_table (file_table);
+        for (auto it = file_table.begin(); it != file_table.end(); ++it)
+            if (file_png == it->second.type)
+                images.push_back (it->second);
+    }
+    else
+    {
+        std::vector<std::string> file_list;
+        if (!read_file_list (opt.args[0].c_str(), file_list))
+        {
+            std::cerr << opt.args[0] << ": cannot open file list.\n";
+            return 1;
+        }
+        for (auto it = file_list.begin(); it != file_list.end(); ++it)
+        {
+            file_info info = get_file_info (it->c_str());
+            if (file_png == info.type)
+                images.push_back (info);
+        }
+    }
+    console_progress progress (opt.verbose);
+    opt.pack.workers = opt.workers;
+    return precompile_images (images, progress, opt.pack) ? 0 : 1;
+}
+
+} // anonymous namespace
+
+int main (int argc, char* argv[])
+try
+{
+    options opt;
+    int rc = -1;
+    if (argc > 1 && parse_options (argc, argv, opt))
+    {
+        std::string command (argv[1]);
+        if ("extract" == command || "x" == command)
+            rc = extract_command (opt);
+        else if ("create" == command || "c" == command)
+            rc = create_command (opt);
+        else if ("patch" == command)
+            rc = patch_command (opt);
+        else if ("compact" == command)
+            rc = compact_command (opt);
+        else if ("precompile" == command)
+            rc = precompile_command (opt);
+        else if ("list" == command || "l" == command)
+            rc = list_command (opt);
+    }
+    if (-1 == rc)
+    {
+        std::cout << usage_text;
+        return 2;
+    }
+    return rc;
+}
+catch (sys::generic_error& X)
+{
+    std::cerr << "xami-cli: " << X.get_description<char>() << '\n';
+    return 1;
+}
+catch (std::exception& X)
+{
+    std::cerr << "xami-cli: " << X.what() << '\n';
+    return 1;
+}
@@ -81,10 +81,19 @@ read ()
     extract_image_format = read_string (_T("Extract"), _T("ImageFormat"), _T("PNG"));
     extract_texts = read_int (_T("Extract"), _T("ExtractTexts"), 1);
     extract_images = read_int (_T("Extract"), _T("ExtractImages"), 1);
+    extract_workers = read_int (_T("Extract"), _T("Workers"), 0);
+    extract_queue_depth = read_int (_T("Extract"), _T("QueueDepth"), 32);
+    extract_memory_budget = read_int (_T("Extract"), _T("MemoryBudget"), 256);
+    extract_by_offset = read_int (_T("Extract"), _T("ScheduleByOffset"), 1);
+    extract_use_index = read_int (_T("Extract"), _T("UseIndex"), 0);
 
     pack_source_folder = read_string (_T("Pack"), _T("SourceFolder"), pack_source_folder);
     pack_target_archive = read_string (_T("Pack"), _T("TargetArchive"), pack_target_archive);
     copy_from_source_archive = read_int (_T("Pack"), _T("CopyFromSource"), 1);
+    pack_workers = read_int (_T("Pack"), _T("Workers"), 0);
+    pack_use_cache = read_int (_T("Pack"), _T("UseCache"), 0);
+    pack_dedup = read_int (_T("Pack"), _T("Dedup"), 0);
+    pack_compression = read_string (_T("Pack"), _T("Compression"), _T("max"));
 
     return true;
 }
@@ -104,10 +113,19 @@ save () const
     write_value (_T("Extract"), _T("ImageFormat"), extract_image_format);
     write_value (_T("Extract"), _T("ExtractTexts"), extract_texts);
     write_value (_T("Extract"), _T("ExtractImages"), extract_images);
+    write_value (_T("Extract"), _T("Workers"), extract_workers);
+    write_value (_T("Extract"), _T("QueueDepth"), extract_queue_depth);
+    write_value (_T("Extract"), _T("MemoryBudget"), extract_memory_budget);
+    write_value (_T("Extract"), _T("ScheduleByOffset"), extract_by_offset);
+    write_value (_T("Extract"), _T("UseIndex"), extract_use_index);
 
     write_value (_T("Pack"), _T("SourceFolder"), pack_source_folder);
     write_value (_T("Pack"), _T("TargetArchive"), pack_target_archive);
     write_value (_T("Pack"), _T("CopyFromSource"), copy_from_source_archive);
+    write_value (_T("Pack"), _T("Workers"), pack_workers);
+    write_value (_T("Pack"), _T("UseCache"), pack_use_cache);
+    write_value (_T("Pack"), _T("Dedup"), pack_dedup);
+    write_value (_T("Pack"), _T("Compression"), pack_compression);
 
     if (-1 != window_x && -1 != window_y)
     {
@@ -162,6 +180,7 @@ export_settings (HWND hWnd, settings& config)
     {
     case 0: default:        config.extract_image_format = _T("PNG"); break;
     case 1:                 config.extract_image_format = _T("GRP"); break;
+    case 2:                 config.extract_image_format = _T("ZGRP"); break;
     }
 }
 
@@ -188,6 +207,8 @@ import_settings (HWND hWnd, const settings& config)
         int fmt = 1;
         if (_T("GRP") == config.extract_image_format)
             fmt = 2;
+        else if (_T("ZGRP") == config.extract_image_format)
+            fmt = 3;
         ::SendDlgItemMessage (hWnd, IDC_IMAGE_FORMAT, CB_SETCURSEL, fmt-1, 0);
     }
 
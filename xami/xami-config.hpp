@@ -44,9 +44,18 @@ struct settings
     tstring     extract_image_format;
     bool        extract_texts;
     bool        extract_images;
+    int         extract_workers;
+    int         extract_queue_depth;
+    int         extract_memory_budget;    // in megabytes
+    bool        extract_by_offset;
+    bool        extract_use_index;        // keep sidecar index next to the archive
     tstring     pack_source_folder;
     tstring     pack_target_archive;
     bool        copy_from_source_archive;
+    int         pack_workers;
+    bool        pack_use_cache;           // keep compiled entries next to the archive
+    bool        pack_dedup;               // store identical entries once
+    tstring     pack_compression;         // compression preset name
 
     bool read ();
     bool save () const;
@@ -25,6 +25,7 @@
 //
 
 #include "xami-progress.hpp"
+#include "xami-popup.hpp"
 
 namespace xami {
 
@@ -39,6 +40,26 @@ progress_dialog (HWND parent, const TCHAR* title)
     ::EnableWindow (m_parent, FALSE);
 }
 
+bool progress_dialog::
+next (const tstring& filename)
+{
+    set_current_filename (filename);
+    step();
+    process_dialog_messages (m_hwnd);
+    return !aborted();
+}
+
+overwrite_answer progress_dialog::
+confirm_overwrite (const tstring& filename, bool& apply_to_all)
+{
+    confirm_dialog confirm (m_hwnd, filename);
+    int rc = confirm.run();
+    if (IDCANCEL == rc)
+        return overwrite_cancel;
+    apply_to_all = confirm.get_option();
+    return IDYES == rc ? overwrite_yes : overwrite_no;
+}
+
 BOOL CALLBACK progress_dialog::
 ProgressProc (HWND hWnd, UINT msgId, WPARAM wParam, LPARAM lParam)
 {
@@ -28,12 +28,13 @@
 #define XAMI_PROGRESS_HPP
 
 #include "xami.hpp"
+#include "task-progress.hpp"
 #include "windres.h"
 #include <Commctrl.h>
 
 namespace xami {
 
-class progress_dialog
+class progress_dialog : public task_progress
 {
 public:
     progress_dialog (HWND parent, const TCHAR* title);
@@ -62,6 +63,9 @@ public:
     void step ()
         { ::SendDlgItemMessage (m_hwnd, IDC_PROGRESS, PBM_STEPIT, 0, 0); }
 
+    bool next (const tstring& filename);
+    overwrite_answer confirm_overwrite (const tstring& filename, bool& apply_to_all);
+
 private:
     static BOOL CALLBACK ProgressProc (HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
@@ -26,22 +26,48 @@
 
 #include <zlib.h>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
 #include <cstring>
 #include "xami-util.hpp"
+#include "work-queue.hpp"
 #include "sysmemmap.h"
+#include "binio.h"
 #include "png-convert.hpp"
 
 namespace xami {
 
+static int
+inflate_chunks (z_stream& z_str, std::vector<char>& out)
+{
+    const size_t buf_size = 1024;
+    char buf[buf_size];
+    int z_err = Z_OK;
+    while (z_err != Z_STREAM_END)
+    {
+        z_str.next_out = (Byte*) buf;
+        z_str.avail_out = buf_size;
+
+        z_err = ::inflate (&z_str, Z_NO_FLUSH);
+        if (Z_NEED_DICT == z_err || Z_DATA_ERROR ==  z_err || Z_MEM_ERROR == z_err
+            || Z_BUF_ERROR == z_err) // truncated stream
+            break;
+        if (size_t have = buf_size - z_str.avail_out)
+            out.insert (out.end(), buf, buf+have);
+    }
+    return z_err;
+}
+
 size_t
 memory_inflate (const char* zdata, size_t zsize, std::vector<char>& out)
 {
     if (!zsize) return 0;
-    z_stream z_str = { 0 };
+    z_stream z_str = z_stream();
     z_str.next_in = (Byte*) zdata;
     z_str.avail_in = zsize;
 
@@ -49,25 +75,106 @@ memory_inflate (const char* zdata, size_t zsize, std::vector<char>& out)
     if (z_err != Z_OK)
         return 0;
 
-    const size_t buf_size = 1024;
-    char buf[buf_size];
-    while (z_err != Z_STREAM_END)
+    z_err = inflate_chunks (z_str, out);
+    inflateEnd (&z_str);
+    if (Z_STREAM_END != z_err)
+        throw std::runtime_error ("Invalid compressed data stream.");
+    return z_str.total_out;
+}
+
+size_t
+memory_inflate (const char* zdata, size_t zsize, std::vector<char>& out, size_t unpacked_size)
+{
+    if (!unpacked_size)
+        return memory_inflate (zdata, zsize, out);
+    if (!zsize) return 0;
+    z_stream z_str = z_stream();
+    z_str.next_in = (Byte*) zdata;
+    z_str.avail_in = zsize;
+
+    int z_err = inflateInit (&z_str);
+    if (z_err != Z_OK)
+        return 0;
+
+    // declared size comes from the archive table of contents, so it's trusted only as far
+    // as it's plausible for ZSIZE bytes of compressed data.  if stream turns out to be
+    // longer, buffer grows along with the inflated data.
+    const size_t max_presize = zsize * 64 + 1024 * 1024;
+    const size_t start = out.size();
+    out.resize (start + std::min (unpacked_size, max_presize));
+    for (;;)
     {
-        z_str.next_out = (Byte*) buf;
-        z_str.avail_out = buf_size;
+        z_str.next_out = (Byte*) &out[start + z_str.total_out];
+        z_str.avail_out = out.size() - start - z_str.total_out;
+        z_err = ::inflate (&z_str, Z_FINISH);
+        if ((Z_OK != z_err && Z_BUF_ERROR != z_err) || z_str.avail_out)
+            break;
+        out.resize (out.size() + std::max<size_t> (z_str.total_out, 64 * 1024));
+    }
+    out.resize (start + z_str.total_out);
+    inflateEnd (&z_str);
+    if (Z_STREAM_END != z_err)
+        throw std::runtime_error ("Invalid compressed data stream.");
+    return z_str.total_out;
+}
+
+size_t
+memory_inflate_head (const char* zdata, size_t zsize, char* out, size_t size)
+{
+    if (!zsize || !size) return 0;
+    z_stream z_str = z_stream();
+    z_str.next_in = (Byte*) zdata;
+    z_str.avail_in = zsize;
+
+    if (Z_OK != inflateInit (&z_str))
+        return 0;
+    z_str.next_out = (Byte*) out;
+    z_str.avail_out = size;
+    ::inflate (&z_str, Z_SYNC_FLUSH);
+    inflateEnd (&z_str);
+    return z_str.total_out;
+}
+
+size_t
+stream_inflate (const char* zdata, size_t zsize, std::ostream& out)
+{
+    if (!zsize) return 0;
+    z_stream z_str = z_stream();
+    z_str.next_in = (Byte*) zdata;
+    z_str.avail_in = zsize;
 
+    if (Z_OK != inflateInit (&z_str))
+        throw std::bad_alloc();
+
+    const size_t buf_size = 64 * 1024;
+    std::vector<char> buf (buf_size);
+    int z_err = Z_OK;
+    while (Z_STREAM_END != z_err && out)
+    {
+        z_str.next_out = (Byte*) buf.data();
+        z_str.avail_out = buf_size;
         z_err = ::inflate (&z_str, Z_NO_FLUSH);
-        if (Z_NEED_DICT == z_err || Z_DATA_ERROR ==  z_err || Z_MEM_ERROR == z_err)
+        if (Z_OK != z_err && Z_STREAM_END != z_err)
             break;
-        if (size_t have = buf_size - z_str.avail_out)
-            out.insert (out.end(), buf, buf+have);
+        out.write (buf.data(), buf_size - z_str.avail_out);
     }
     inflateEnd (&z_str);
-    if (Z_STREAM_END != z_err)
+    if (Z_STREAM_END != z_err && out)
         throw std::runtime_error ("Invalid compressed data stream.");
     return z_str.total_out;
 }
 
+void
+touch_pages (const char* data, size_t size)
+{
+    const size_t page_size = 4096;
+    volatile char sink = 0;
+    for (size_t i = 0; i < size; i += page_size)
+        sink += data[i];
+    if (size)
+        sink += data[size-1];
+}
+
 bool
 write_png (const tstring& filename, const char* grp_data, size_t size)
 {
@@ -94,6 +201,23 @@ write_png (const tstring& filename, const char* grp_data, size_t size)
     return png::error::none == rc;
 }
 
+bool
+encode_png (const char* grp_data, size_t size, std::vector<char>& out)
+{
+    if (size <= GRP_HEADER_SIZE)
+        return false;
+    const uint8_t* pixel_data = reinterpret_cast<const uint8_t*> (grp_data);
+    const int ref_x = get_grp_ref_x (pixel_data);
+    const int ref_y = get_grp_ref_y (pixel_data);
+    const size_t width  = get_grp_width (pixel_data);
+    const size_t height = get_grp_height (pixel_data);
+    if (width * height * 4 + GRP_HEADER_SIZE > size)
+        return false;
+    pixel_data += GRP_HEADER_SIZE;
+    out.clear();
+    return png::error::none == png::encode (out, pixel_data, width, height, ref_x, ref_y);
+}
+
 bool
 read_file_list (const char* input_name, std::vector<std::string>& file_list)
 {
@@ -125,6 +249,61 @@ get_id_from_name (const tstring& name)
     return _tcstoul (&name[start_pos], 0, 16);
 }
 
+#ifdef _WIN32
+
+class local_mem
+{
+    HLOCAL	m_handle;
+public:
+    explicit local_mem (HLOCAL handle) : m_handle (handle) {}
+    ~local_mem () { if (m_handle) ::LocalFree (m_handle); }
+};
+
+tstring
+get_error_text (int error_code)
+{
+    if (error_code != NO_ERROR)
+    {
+	TCHAR *msg_buf;
+	if (::FormatMessage (FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM,
+			     NULL, error_code, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+			     (LPTSTR) &msg_buf, 0, NULL))
+	{
+	    local_mem sentry (msg_buf);
+            return tstring (msg_buf);
+	}
+    }
+    return tstring (_T("No error"));
+}
+
+#else
+
+tstring
+get_error_text (int error_code)
+{
+    if (error_code)
+        return tstring (std::strerror (error_code)) + _T('\n');
+    return tstring (_T("No error"));
+}
+
+#endif
+
+static file_type
+file_type_from_name (const TCHAR* filename)
+{
+    file_type type = file_raw;
+    if (const TCHAR* dot = _tcsrchr (filename, _T('.')))
+    {
+        if (0 == icase::strcmp (dot, _T(".png")))
+            type = file_png;
+        else if (0 == icase::strcmp (dot, _T(".zgrp")))
+            type = file_zgrp;
+    }
+    return type;
+}
+
+#ifdef _WIN32
+
 file_info
 get_file_info (const TCHAR* filename)
 {
@@ -141,49 +320,222 @@ get_file_info (const TCHAR* filename)
         TCERR << filename << _T(": file is too long.\n");
         throw std::runtime_error ("File is too long.");
     }
-    file_type type = file_raw;
-    if (const TCHAR* dot = _tcsrchr (filename, _T('.')))
+    return file_info (find_data, file_type_from_name (filename));
+}
+
+#else
+
+file_info
+get_file_info (const TCHAR* filename)
+{
+    struct stat st;
+    if (-1 == ::stat (filename, &st) || !S_ISREG (st.st_mode))
     {
-        if (0 == icase::strcmp (dot, _T(".png")))
-            type = file_png;
-        else if (0 == icase::strcmp (dot, _T(".zgrp")))
-            type = file_zgrp;
+        TCERR << filename << _T(": file not found.\n");
+        throw std::runtime_error ("File not found.");
     }
-    return file_info (find_data, type);
+    if (uint64_t (st.st_size) > 0xffffffffu)
+    {
+        TCERR << filename << _T(": file is too long.\n");
+        throw std::runtime_error ("File is too long.");
+    }
+    return file_info (filename, st, file_type_from_name (filename));
 }
 
-size_t
-deflate_data (std::ostream& out, const uint8_t* input, size_t size)
+#endif
+
+deflate_params
+get_compression_params (compression_preset preset)
+{
+    switch (preset)
+    {
+    case compression_fast:      return deflate_params (1);
+    case compression_default:   return deflate_params (Z_DEFAULT_COMPRESSION);
+    case compression_auto:
+        {
+            deflate_params params;
+            params.tune = true;
+            return params;
+        }
+    default:                    return deflate_params (Z_BEST_COMPRESSION);
+    }
+}
+
+bool
+parse_compression_preset (const TCHAR* name, compression_preset& preset)
+{
+    static const TCHAR* const names[] = { _T("fast"), _T("default"), _T("max"), _T("auto") };
+    for (size_t i = 0; i < sizeof(names)/sizeof(names[0]); ++i)
+    {
+        if (0 == icase::strcmp (name, names[i]))
+        {
+            preset = static_cast<compression_preset> (i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// inputs larger than threshold are compressed in blocks, which could be done by several
+// threads, as pigz does.  every block is primed with the preceding 32KB of input, so that
+// compression ratio doesn't suffer much.  blocks are used regardless of the number of
+// threads, so that output doesn't depend on it.
+const size_t deflate_block_size = 256 * 1024;
+const size_t deflate_block_threshold = 1024 * 1024;
+const size_t deflate_dict_size = 32 * 1024;
+
+static void
+deflate_block (const uint8_t* input, size_t size, size_t pos, const deflate_params& params,
+               std::string& out, uLong& adler)
+{
+    const uint8_t* block = input + pos;
+    const size_t block_size = std::min (deflate_block_size, size - pos);
+    const bool is_last = pos + block_size == size;
+    adler = adler32 (1, block, block_size);
+
+    z_stream z_str = z_stream();
+    if (Z_OK != deflateInit2 (&z_str, params.level, Z_DEFLATED, -MAX_WBITS, 8, params.strategy))
+        throw std::bad_alloc();
+    if (pos)
+    {
+        size_t dict_size = std::min (deflate_dict_size, pos);
+        deflateSetDictionary (&z_str, block - dict_size, dict_size);
+    }
+    // sync flush appends empty stored block, so that next block starts at byte boundary.
+    out.resize (deflateBound (&z_str, block_size) + 16);
+    z_str.next_in = (Byte*) block;
+    z_str.avail_in = block_size;
+    const int flush = is_last ? Z_FINISH : Z_SYNC_FLUSH;
+    for (;;)
+    {
+        z_str.next_out = (Byte*) &out[z_str.total_out];
+        z_str.avail_out = out.size() - z_str.total_out;
+        int rc = deflate (&z_str, flush);
+        if (is_last ? Z_STREAM_END == rc : 0 != z_str.avail_out)
+            break;
+        out.resize (out.size() + deflate_dict_size);
+    }
+    deflateEnd (&z_str);
+    out.resize (z_str.total_out);
+}
+
+static size_t
+deflate_blocks (std::ostream& out, const uint8_t* input, size_t size, const deflate_params& params)
+{
+    const size_t count = (size + deflate_block_size - 1) / deflate_block_size;
+    std::vector<std::string> blocks (count);
+    std::vector<uLong> checksums (count);
+    std::vector<std::exception_ptr> errors (count);
+    std::atomic<size_t> next_block (0);
+    auto compress = [&] ()
+    {
+        for (size_t i = next_block++; i < count; i = next_block++)
+        {
+            try
+            {
+                deflate_block (input, size, i * deflate_block_size, params, blocks[i], checksums[i]);
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+    {
+        thread_group threads;
+        threads.create (std::min<size_t> (params.threads, count) - 1, compress);
+        compress();
+    }
+    for (size_t i = 0; i < count; ++i)
+        if (errors[i])
+            std::rethrow_exception (errors[i]);
+    // zlib header is the same as deflate() would produce
+    int level = Z_DEFAULT_COMPRESSION == params.level ? 6 : params.level;
+    unsigned level_flags = params.strategy >= Z_HUFFMAN_ONLY || level < 2 ? 0
+                         : level < 6 ? 1 : level == 6 ? 2 : 3;
+    unsigned header = (Z_DEFLATED + ((MAX_WBITS - 8) << 4)) << 8 | level_flags << 6;
+    header += 31 - header % 31;
+    out.put (char (header >> 8));
+    out.put (char (header));
+    size_t total = 2;
+    uLong adler = checksums[0];
+    for (size_t i = 0; i < count; ++i)
+    {
+        out.write (blocks[i].data(), blocks[i].size());
+        total += blocks[i].size();
+        if (i)
+            adler = adler32_combine (adler, checksums[i], std::min (deflate_block_size,
+                                                                    size - i * deflate_block_size));
+    }
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.put (char (adler >> shift));
+    return total + 4;
+}
+
+static size_t
+deflate_stream (std::ostream& out, const uint8_t* input, size_t size, const deflate_params& params)
 {
-    z_stream z_str = { 0 };
+    if (size > deflate_block_threshold)
+        return deflate_blocks (out, input, size, params);
+
+    z_stream z_str = z_stream();
+    int z_err = deflateInit2 (&z_str, params.level, Z_DEFLATED, MAX_WBITS, 8, params.strategy);
+    if (z_err != Z_OK)
+        return 0;
+
+    // whole stream is compressed into buffer that surely fits it and written at once.
+    std::vector<char> buf (deflateBound (&z_str, size));
     z_str.next_in = (Byte*) input;
     z_str.avail_in = size;
-    int z_err = deflateInit (&z_str, 9);
-    if (z_err != Z_OK)
+    z_str.next_out = (Byte*) buf.data();
+    z_str.avail_out = buf.size();
+    z_err = deflate (&z_str, Z_FINISH);
+    deflateEnd (&z_str);
+    if (z_err != Z_STREAM_END)
         return 0;
+    out.write (buf.data(), z_str.total_out);
+    return z_str.total_out;
+}
 
-    const size_t buf_size = 512;
-    char buf[buf_size];
-    int flush = Z_NO_FLUSH;
-    while (Z_FINISH != flush)
+size_t
+deflate_data (std::ostream& out, const uint8_t* input, size_t size, deflate_params& params)
+{
+    if (!params.tune)
+        return deflate_stream (out, input, size, params);
+
+    // images with large solid areas compress better with run-length encoding, while
+    // filtered strategy suits noisy ones.  lazy matching of the lower level occasionally
+    // beats the maximum one.  run-length encoding doesn't depend on the level.
+    static const struct { int level, strategy; } candidates[] = {
+        { Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY },
+        { Z_BEST_COMPRESSION, Z_FILTERED },
+        { 6, Z_DEFAULT_STRATEGY },
+        { 6, Z_FILTERED },
+        { Z_BEST_COMPRESSION, Z_RLE },
+    };
+    std::string best;
+    deflate_params candidate (params);
+    for (size_t i = 0; i < sizeof(candidates)/sizeof(candidates[0]); ++i)
     {
-        flush = z_str.avail_in ? Z_NO_FLUSH : Z_FINISH;
-        do
+        std::ostringstream buf;
+        candidate.level = candidates[i].level;
+        candidate.strategy = candidates[i].strategy;
+        deflate_stream (buf, input, size, candidate);
+        if (!i || buf.tellp() < std::streamoff (best.size()))
         {
-            z_str.next_out = (Byte*) buf;
-            z_str.avail_out = buf_size;
-            deflate (&z_str, flush);
-            if (size_t have = buf_size - z_str.avail_out)
-                out.write (buf, have);
-        } while (0 == z_str.avail_out);
-        assert (0 == z_str.avail_in);
+            best = buf.str();
+            params.level = candidate.level;
+            params.strategy = candidate.strategy;
+        }
     }
-    deflateEnd (&z_str);
-    return z_str.total_out;
+    params.tune = false;
+    out.write (best.data(), best.size());
+    return best.size();
 }
 
 size_t
-convert_png (const tstring& filename, std::ostream& out, size_t& compressed_size)
+convert_png (const tstring& filename, std::ostream& out, size_t& compressed_size,
+             deflate_params& params, ext::tostream& log)
 {
     std::vector<uint8_t> image (GRP_HEADER_SIZE);
     unsigned width, height;
@@ -191,12 +543,12 @@ convert_png (const tstring& filename, std::ostream& out, size_t& compressed_size
     png::error rc = png::decode (filename, image, &width, &height, &x, &y);
     if (png::error::none != rc)
     {
-        TCLOG << filename << _T(": ") << png::get_error_text (rc) << std::endl;
+        log << filename << _T(": ") << png::get_error_text (rc) << std::endl;
         throw std::runtime_error ("Error reading PNG image.");
     }
     if (width > 0x7fff || height > 0x7fff)
     {
-        TCLOG << filename << _T(": image resolution is too high (")
+        log << filename << _T(": image resolution is too high (")
             << width << _T('x') << height << _T(")\n");
         throw std::runtime_error ("Unsupported image resolution.");
     }
@@ -207,16 +559,17 @@ convert_png (const tstring& filename, std::ostream& out, size_t& compressed_size
     header[3] = bin::little_word (y);
     header[4] = bin::little_word (width);
     header[5] = bin::little_word (height);
-    compressed_size = deflate_data (out, image.data(), image.size());
+    compressed_size = deflate_data (out, image.data(), image.size(), params);
     return image.size();
 }
 
 size_t
-deflate_file (const tstring& filename, std::ostream& out, size_t& compressed_size)
+deflate_file (const tstring& filename, std::ostream& out, size_t& compressed_size,
+              deflate_params& params)
 {
     sys::mapping::readonly in (filename);
     sys::mapping::const_view<uint8_t> data (in);
-    compressed_size = deflate_data (out, data.begin(), data.size());
+    compressed_size = deflate_data (out, data.begin(), data.size(), params);
     return data.size();
 }
 
@@ -229,6 +582,27 @@ write_raw (const tstring& filename, const char* data, size_t size)
     return !out.fail();
 }
 
+bool
+write_inflated (const tstring& filename, const char* zdata, size_t zsize)
+{
+    std::ofstream out (filename, std::ios::out|std::ios::trunc|std::ios::binary);
+    if (out)
+        stream_inflate (zdata, zsize, out);
+    return !out.fail();
+}
+
+bool
+write_zgrp (const tstring& filename, const char* zdata, size_t zsize, size_t unpacked_size)
+{
+    std::ofstream out (filename, std::ios::out|std::ios::trunc|std::ios::binary);
+    if (out)
+    {
+        bin::write32bit (out, unpacked_size);
+        out.write (zdata, zsize);
+    }
+    return !out.fail();
+}
+
 size_t
 copy_file (const tstring& filename, std::ostream& out)
 {
@@ -27,11 +27,17 @@
 #ifndef XAMI_UTIL_HPP
 #define XAMI_UTIL_HPP
 
+#include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 #include <tchar.h>
 #include "bindata.h"
 #include "xami-types.hpp"
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <cerrno>
+#endif
 
 namespace xami {
 
@@ -49,17 +55,46 @@ enum file_type
     file_xml,
 };
 
+// parameters of the deflate compression.
+struct deflate_params
+{
+    int         level;
+    int         strategy;   // zlib compression strategy
+    bool        tune;       // look for the parameters that give the smallest output
+    unsigned    threads;    // number of threads compressing large inputs
+
+    deflate_params (int lvl = 9, int strat = 0)
+        : level (lvl), strategy (strat), tune (false), threads (1) { }
+};
+
+enum compression_preset
+{
+    compression_fast,
+    compression_default,
+    compression_max,
+    compression_auto,   // choose parameters for each entry
+};
+
+// deflate parameters corresponding to PRESET.
+deflate_params get_compression_params (compression_preset preset);
+
+// Returns: FALSE if NAME isn't one of "fast", "default", "max" or "auto".
+bool parse_compression_preset (const TCHAR* name, compression_preset& preset);
+
 struct file_info
 {
     tstring     name;
     size_t      size;
     file_type   type;
-    FILETIME    time;
+    uint64_t    time;       // last write time, in system-specific units
+    std::shared_ptr<const std::vector<char>>
+                contents;   // data read while building file table, if any
 
     file_info () { }
     file_info (const TCHAR* n, size_t s, file_type t = file_raw)
-        : name (n), size (s), type (t)
+        : name (n), size (s), type (t), time (0)
     { }
+#ifdef _WIN32
     file_info (const WIN32_FIND_DATA& fd, file_type tp) { assign (fd, tp); }
 
     void assign (const WIN32_FIND_DATA& fd, file_type tp)
@@ -67,17 +102,72 @@ struct file_info
         name = fd.cFileName;
         size = fd.nFileSizeLow;
         type = tp;
-        time = fd.ftLastWriteTime;
+        time = uint64_t (fd.ftLastWriteTime.dwHighDateTime) << 32
+             | fd.ftLastWriteTime.dwLowDateTime;
+        contents.reset();
     }
+#else
+    file_info (const TCHAR* n, const struct stat& st, file_type tp) { assign (n, st, tp); }
+
+    void assign (const TCHAR* n, const struct stat& st, file_type tp)
+    {
+        name = n;
+        size = st.st_size;
+        type = tp;
+#if defined(__APPLE__)
+        time = uint64_t (st.st_mtimespec.tv_sec) * 1000000000u + st.st_mtimespec.tv_nsec;
+#elif defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
+        time = uint64_t (st.st_mtim.tv_sec) * 1000000000u + st.st_mtim.tv_nsec;
+#else   // nanoseconds aren't available
+        time = uint64_t (st.st_mtime) * 1000000000u;
+#endif
+        contents.reset();
+    }
+#endif
 };
 
+// text description of the system error code ERROR_CODE.
+tstring get_error_text (int error_code);
+
+#ifdef _WIN32
+inline int last_error () { return ::GetLastError(); }
+const int error_file_exists = ERROR_FILE_EXISTS;
+#else
+inline int last_error () { return errno; }
+const int error_file_exists = EEXIST;
+#endif
+
 // inflate data stream stored into ZDATA, ZSIZE bytes length and put result into OUT.
 size_t memory_inflate (const char* zdata, size_t zsize, std::vector<char>& out);
 
+// same as above, but inflate directly into OUT enlarged by UNPACKED_SIZE bytes.  if
+// actual size of the stream differs, OUT is adjusted accordingly.
+size_t memory_inflate (const char* zdata, size_t zsize, std::vector<char>& out,
+                       size_t unpacked_size);
+
+// inflate no more than SIZE first bytes of the data stream stored into ZDATA, ZSIZE bytes
+// length, and put them into OUT.
+// Returns: number of bytes written into OUT.
+size_t memory_inflate_head (const char* zdata, size_t zsize, char* out, size_t size);
+
+// inflate data stream stored into ZDATA, ZSIZE bytes length into OUT chunk by chunk, so
+// that memory used doesn't depend on the size of the stream.
+// Returns: number of bytes written into OUT.
+size_t stream_inflate (const char* zdata, size_t zsize, std::ostream& out);
+
+// read one byte from every page of mapped memory region DATA, so that subsequent
+// access to it won't stall on disk reads.
+void touch_pages (const char* data, size_t size);
+
 // read raw RGBA data stored within GRP_DATA in muv-luv GRP format and write it into
 // file FILENAME in PNG format.
 bool write_png (const tstring& filename, const char* grp_data, size_t size);
 
+// same as write_png, but put resulting PNG stream into OUT.  doesn't write anything to
+// the log, so it could be called from worker threads.
+// Returns: FALSE if GRP_DATA is invalid or PNG encoder failed.
+bool encode_png (const char* grp_data, size_t size, std::vector<char>& out);
+
 // read SCR text script data from SCR_DATA and write it into FILENAME in MLT format.
 bool write_script (const tstring& filename, uint32_t id, const char* scr_data,
                    size_t size, encoding_id enc = enc_shift_jis);
@@ -89,8 +179,18 @@ bool write_script_txt (std::ostream& out, uint32_t file_id, const char* scr_data
 bool write_script_xml (std::ostream& out, uint32_t file_id, const char* scr_data,
                        size_t size, encoding_id enc);
 
+// check that text lines table of SCR_DATA doesn't point outside of the script.
+bool check_script (const char* scr_data, size_t size);
+
 bool write_raw (const tstring& filename, const char* data, size_t size);
 
+// inflate data stream ZDATA of ZSIZE bytes into file FILENAME.
+bool write_inflated (const tstring& filename, const char* zdata, size_t zsize);
+
+// write compressed image ZDATA of ZSIZE bytes into FILENAME in the format read by
+// copy_zgrp, prefixed with UNPACKED_SIZE.
+bool write_zgrp (const tstring& filename, const char* zdata, size_t zsize, size_t unpacked_size);
+
 // get info about FILENAME without opening it (size, name and type)
 file_info get_file_info (const TCHAR* filename);
 
@@ -98,9 +198,11 @@ file_info get_file_info (const TCHAR* filename);
 unsigned get_id_from_name (const tstring& name);
 
 // convert PNG image stored in FILENAME into compressed muv-luv grp stream and write
-// it into OUT.  size of the stream is stored into COMPRESSED_SIZE.
+// it into OUT.  size of the stream is stored into COMPRESSED_SIZE.  conversion errors
+// are reported into LOG.
 // Returns: size of the uncompressed stream.
-size_t convert_png (const tstring& filename, std::ostream& out, size_t& compressed_size);
+size_t convert_png (const tstring& filename, std::ostream& out, size_t& compressed_size,
+                    deflate_params& params, ext::tostream& log = TCLOG);
 
 // read compressed stream stream from FILENAME and copy it into OUT.
 // first 4 bytes of the stream represent its uncompressed size and are returned to
@@ -114,7 +216,16 @@ size_t copy_file (const tstring& filename, std::ostream& out);
 // deflate data stored in the FILENAME and write deflated stream into OUT.  size of the
 // stream is stored into COMPRESSED_SIZE.
 // Returns: original size of FILENAME
-size_t deflate_file (const tstring& filename, std::ostream& out, size_t& compressed_size);
+size_t deflate_file (const tstring& filename, std::ostream& out, size_t& compressed_size,
+                     deflate_params& params);
+
+// deflate SIZE bytes of INPUT into OUT using PARAMS.  if PARAMS.tune is set, parameters
+// giving the smallest stream are chosen and stored into PARAMS.  large inputs are split
+// into blocks compressed by PARAMS.threads threads and joined into single zlib stream,
+// which is slightly larger than the one deflated at once, but doesn't depend on the
+// number of threads.
+// Returns: size of the deflated stream.
+size_t deflate_data (std::ostream& out, const uint8_t* input, size_t size, deflate_params& params);
 
 // prepend muv-luv GRP header to the raw RGBA image data supplied into INPUT using WIDTH
 // and HEIGHT as image dimensions, and REF_X and REF_Y as GRP reference points. after
@@ -123,6 +123,7 @@ init_dialog (HWND hWnd, const settings& config)
 
     ::SendDlgItemMessage (hWnd, IDC_IMAGE_FORMAT, CB_ADDSTRING, 0, (LPARAM)_T("PNG"));
     ::SendDlgItemMessage (hWnd, IDC_IMAGE_FORMAT, CB_ADDSTRING, 0, (LPARAM)_T("Raw GRP"));
+    ::SendDlgItemMessage (hWnd, IDC_IMAGE_FORMAT, CB_ADDSTRING, 0, (LPARAM)_T("Packed ZGRP"));
     ::SendDlgItemMessage (hWnd, IDC_IMAGE_FORMAT, CB_SETCURSEL, 0, 0);
 
     import_settings (hWnd, config);
@@ -313,31 +314,6 @@ flash_control (int id)
     }
 }
 
-class local_mem
-{
-    HLOCAL	m_handle;
-public:
-    explicit local_mem (HLOCAL handle) : m_handle (handle) {}
-    ~local_mem () { if (m_handle) ::LocalFree (m_handle); }
-};
-
-tstring
-get_error_text (int error_code)
-{
-    if (error_code != NO_ERROR)
-    {
-	TCHAR *msg_buf;
-	if (::FormatMessage (FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM,
-			     NULL, error_code, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-			     (LPTSTR) &msg_buf, 0, NULL))
-	{
-	    local_mem sentry (msg_buf);
-            return tstring (msg_buf);
-	}
-    }
-    return tstring (_T("No error"));
-}
-
 void
 change_extract_button_state ()
 {
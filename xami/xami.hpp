@@ -29,6 +29,7 @@
 
 #include <windows.h>
 #include "xami-types.hpp"
+#include "xami-util.hpp"
 #include "windres.h"
 
 namespace xami {
@@ -37,7 +38,6 @@ extern HINSTANCE    g_happ;
 extern HWND         g_hwnd;
 extern HFONT        g_dlg_font;
 
-tstring get_error_text (int error_code);
 void process_dialog_messages (HWND hwnd);
 void flash_control (int id);
 